@@ -14,6 +14,43 @@ static const char titletrim[]   = "...";
 static const int  tabwidth      = 200;
 static const Bool foreground    = True;
 static       Bool urgentswitch  = False;
+static const Bool showstats     = False; /* print counters on exit */
+static const Bool respawn       = False; /* rerun a dead tab once selected */
+static const Bool controlsocket = True;  /* see CONTROL in tabbed(1) */
+
+/*
+ * Stop the process of a tab with SIGSTOP once it was in the background for
+ * freezedelay seconds, and continue it before it is selected again. 0 never
+ * stops them. Urgent tabs and those whose WM_CLASS instance or class is
+ * listed in nofreeze keep running.
+ */
+static const int freezedelay    = 0;
+static const char *nofreeze[]   = { "mpv" };
+
+/*
+ * Under memory pressure, close the least recently used background tab that
+ * was started from the command, and keep it as a placeholder that runs the
+ * command again once it is selected. Pressure is either discardstall us of
+ * memory stall within two seconds, as reported by /proc/pressure/memory, or
+ * the tabs' processes using more than discardrss MiB. 0 disables either.
+ */
+static const int discardstall   = 0;
+static const int discardrss     = 0;
+
+/*
+ * Background tabs: 0 leaves them alone, 1 deactivates them and sets
+ * _NET_WM_STATE_HIDDEN on them, 2 also unmaps them, so they stop drawing
+ * even under a compositor.
+ */
+static const int hidetabs       = 0;
+
+/*
+ * While the container is resized interactively, wait until it was not
+ * resized for resizedelay ms, but at most resizemaxdelay ms, before the
+ * selected client is resized. 0 resizes it right away.
+ */
+static const int resizedelay    = 50;
+static const int resizemaxdelay = 250;
 
 /*
  * Where to place a new tab when it is opened. When npisrelative is True,
@@ -45,6 +82,7 @@ static const Key keys[] = {
 	{ MODKEY,               XK_Tab,       rotate,      { .i = 0 } },
 
 	{ MODKEY,               XK_grave,     spawn,       SETPROP("_TABBED_SELECT_TAB") },
+	{ MODKEY|ShiftMask,     XK_f,         switcher,    { 0 } },
 	{ MODKEY,               XK_1,         move,        { .i = 0 } },
 	{ MODKEY,               XK_2,         move,        { .i = 1 } },
 	{ MODKEY,               XK_3,         move,        { .i = 2 } },
@@ -57,6 +95,7 @@ static const Key keys[] = {
 	{ MODKEY,               XK_0,         move,        { .i = 9 } },
 
 	{ MODKEY,               XK_q,         killclient,  { 0 } },
+	{ MODKEY|ShiftMask,     XK_d,         detach,      { 0 } },
 
 	{ MODKEY,               XK_u,         focusurgent, { 0 } },
 	{ MODKEY|ShiftMask,     XK_u,         toggle,      { .v = (void*) &urgentswitch } },
@@ -0,0 +1,113 @@
+/* See LICENSE file for copyright and license details. */
+
+/* appearance */
+static const char font[]        = "monospace:size=9";
+static const char* normbgcolor  = "#222222";
+static const char* normfgcolor  = "#cccccc";
+static const char* selbgcolor   = "#555555";
+static const char* selfgcolor   = "#ffffff";
+static const char* urgbgcolor   = "#111111";
+static const char* urgfgcolor   = "#cc0000";
+static const char before[]      = "<";
+static const char after[]       = ">";
+static const char titletrim[]   = "...";
+static const int  tabwidth      = 200;
+static const Bool foreground    = True;
+static       Bool urgentswitch  = False;
+static const Bool showstats     = False; /* print counters on exit */
+static const Bool respawn       = False; /* rerun a dead tab once selected */
+static const Bool controlsocket = True;  /* see CONTROL in tabbed(1) */
+
+/*
+ * Stop the process of a tab with SIGSTOP once it was in the background for
+ * freezedelay seconds, and continue it before it is selected again. 0 never
+ * stops them. Urgent tabs and those whose WM_CLASS instance or class is
+ * listed in nofreeze keep running.
+ */
+static const int freezedelay    = 0;
+static const char *nofreeze[]   = { "mpv" };
+
+/*
+ * Under memory pressure, close the least recently used background tab that
+ * was started from the command, and keep it as a placeholder that runs the
+ * command again once it is selected. Pressure is either discardstall us of
+ * memory stall within two seconds, as reported by /proc/pressure/memory, or
+ * the tabs' processes using more than discardrss MiB. 0 disables either.
+ */
+static const int discardstall   = 0;
+static const int discardrss     = 0;
+
+/*
+ * Background tabs: 0 leaves them alone, 1 deactivates them and sets
+ * _NET_WM_STATE_HIDDEN on them, 2 also unmaps them, so they stop drawing
+ * even under a compositor.
+ */
+static const int hidetabs       = 0;
+
+/*
+ * While the container is resized interactively, wait until it was not
+ * resized for resizedelay ms, but at most resizemaxdelay ms, before the
+ * selected client is resized. 0 resizes it right away.
+ */
+static const int resizedelay    = 50;
+static const int resizemaxdelay = 250;
+
+/*
+ * Where to place a new tab when it is opened. When npisrelative is True,
+ * then the current position is changed + newposition. If npisrelative
+ * is False, then newposition is an absolute position.
+ */
+static int  newposition   = 0;
+static Bool npisrelative  = False;
+
+#define SETPROP(p) { \
+        .v = (char *[]){ "/bin/sh", "-c", \
+                "prop=\"`xwininfo -children -id $1 | grep '^     0x' |" \
+                "sed -e's@^ *\\(0x[0-9a-f]*\\) \"\\([^\"]*\\)\".*@\\1 \\2@' |" \
+                "xargs -0 printf %b | dmenu -l 10 -w $1`\" &&" \
+                "xprop -id $1 -f $0 8s -set $0 \"$prop\"", \
+                p, winid, NULL \
+        } \
+}
+
+#define MODKEY ControlMask
+static const Key keys[] = {
+	/* modifier             key           function     argument */
+	{ MODKEY|ShiftMask,     XK_Return,    focusonce,   { 0 } },
+	{ MODKEY|ShiftMask,     XK_Return,    spawn,       { 0 } },
+	{ MODKEY|ShiftMask,     XK_l,         rotate,      { .i = +1 } },
+	{ MODKEY|ShiftMask,     XK_h,         rotate,      { .i = -1 } },
+	{ MODKEY|ShiftMask,     XK_j,         movetab,     { .i = -1 } },
+	{ MODKEY|ShiftMask,     XK_k,         movetab,     { .i = +1 } },
+	{ MODKEY,               XK_Tab,       rotate,      { .i = 0 } },
+
+	{ MODKEY,               XK_grave,     spawn,       SETPROP("_TABBED_SELECT_TAB") },
+	{ MODKEY|ShiftMask,     XK_f,         switcher,    { 0 } },
+	{ MODKEY,               XK_1,         move,        { .i = 0 } },
+	{ MODKEY,               XK_2,         move,        { .i = 1 } },
+	{ MODKEY,               XK_3,         move,        { .i = 2 } },
+	{ MODKEY,               XK_4,         move,        { .i = 3 } },
+	{ MODKEY,               XK_5,         move,        { .i = 4 } },
+	{ MODKEY,               XK_6,         move,        { .i = 5 } },
+	{ MODKEY,               XK_7,         move,        { .i = 6 } },
+	{ MODKEY,               XK_8,         move,        { .i = 7 } },
+	{ MODKEY,               XK_9,         move,        { .i = 8 } },
+	{ MODKEY,               XK_0,         move,        { .i = 9 } },
+
+	{ MODKEY,               XK_q,         killclient,  { 0 } },
+	{ MODKEY|ShiftMask,     XK_d,         detach,      { 0 } },
+
+	{ MODKEY,               XK_u,         focusurgent, { 0 } },
+	{ MODKEY|ShiftMask,     XK_u,         toggle,      { .v = (void*) &urgentswitch } },
+
+	{ 0,                    XK_F11,       fullscreen,  { 0 } },
+
+	{ MODKEY,               XK_Shift_L,   showbar,     { .i = 1 } },
+	{ ShiftMask,            XK_Control_L, showbar,     { .i = 1 } },
+};
+
+static Key keyreleases[] = {
+	/* modifier             key          function     argument */
+	{ MODKEY|ShiftMask,     XK_Shift_L,  showbar,     { .i = 0 } },
+	{ MODKEY|ShiftMask,     XK_Control_L,  showbar,     { .i = 0 } },
+};
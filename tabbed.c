@@ -2,19 +2,29 @@
  * See LICENSE file for copyright and license details.
  */
 
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <locale.h>
+#include <poll.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <X11/Xatom.h>
 #include <X11/Xlib.h>
 #include <X11/Xproto.h>
 #include <X11/Xutil.h>
 #include <X11/XKBlib.h>
+#include <X11/Xlib-xcb.h>
 #include <X11/Xft/Xft.h>
 
 #include "arg.h"
@@ -47,10 +57,15 @@
 #define LENGTH(x)               (sizeof((x)) / sizeof(*(x)))
 #define CLEANMASK(mask)         (mask & ~(numlockmask | LockMask))
 #define TEXTW(x)                (textnw(x, strlen(x)) + dc.font.height)
+#define NAMELEN                 256
+#define CTLBACKLOG              65536 /* unsent bytes a connection may have */
+#define LOWER(c)                ((c) >= 'A' && (c) <= 'Z' ? (c) + 32 : (c))
 
 enum { ColFG, ColBG, ColLast };       /* color */
+enum { TimerResize, TimerSession, TimerFreeze, TimerDiscard,
+       TimerLast }; /* timers */
 enum { WMProtocols, WMDelete, WMName, WMState, WMFullscreen,
-       XEmbed, WMSelectTab, WMIcon, WMLast }; /* default atoms */
+       XEmbed, WMSelectTab, WMIcon, WMPid, WMHidden, WMLast }; /* default atoms */
 
 typedef union {
 	int i;
@@ -64,12 +79,19 @@ typedef struct {
 	const Arg arg;
 } Key;
 
+typedef struct {
+	unsigned int mod; /* without lock modifiers */
+	const Key *key;
+} Binding;
+
 typedef struct {
 	int x, y, w, h;
 	XftColor norm[ColLast];
 	XftColor sel[ColLast];
 	XftColor urg[ColLast];
 	Drawable drawable;
+	int drawablew; /* only grows, the bar is drawn into its top left */
+	XftDraw *xftdraw;
 	GC gc;
 	struct {
 		int ascent;
@@ -80,65 +102,200 @@ typedef struct {
 } DC; /* draw context */
 
 typedef struct {
-	char name[256];
-	Window win;
-	int tabx;
-	Bool urgent;
+	int w;      /* width the text was fitted into */
+	int len;    /* bytes of the text to draw, -1 if stale */
+	Bool trim;  /* append titletrim */
+} Fit; /* memoised title truncation */
+
+typedef struct {
+	int key; /* a trigram of the title */
+	int pos; /* where the client is in its posting list */
+} Gram;
+
+typedef struct Client Client;
+struct Client {
+	char *name; /* NAMELEN bytes in the title arena */
+	Gram *grams; /* distinct trigrams of name, kept when the slot is reused */
+	int ngrams, gramcap;
+	Fit fit;
 	Bool closed;
-} Client;
+	Bool protodel; /* WM_PROTOCOLS has WM_DELETE_WINDOW */
+	Bool dirty;
+	Bool iconvalid;
+	unsigned long *icon; /* _NET_WM_ICON, as longs for XChangeProperty() */
+	unsigned long nicon;
+	Pixmap iconpixmap, iconmask; /* WM_HINTS icon without _NET_WM_ICON */
+	unsigned long iconhash;
+	int y, w, h; /* geometry last sent by resize(), w is -1 if unknown */
+	pid_t pid; /* owning process, 0 if unknown */
+	int pidfd; /* polled for its exit, -1 if unavailable */
+	int id; /* pool slot, never changes */
+	Bool fromcmd; /* started from cmd, can be started again */
+	char *arg; /* appended to cmd, NULL if none */
+	Bool spawning; /* a placeholder whose command was started */
+	Bool frozen, nofreeze; /* stopped, never to be stopped */
+	long long idle; /* when it was last unselected, in ms */
+	Bool hidden; /* deactivated, and unmapped if hidetabs > 1 */
+	int unmaps; /* UnmapNotify events we caused and must ignore */
+	Bool stateasked; /* stateck awaits unsethidden() */
+	xcb_get_property_cookie_t stateck; /* _NET_WM_STATE, from showtab() */
+	Client *next; /* free list */
+};
+
+typedef struct {
+	Window win;
+	int c;
+} WinSlot; /* Window to client index, open addressing */
+
+typedef struct {
+	int fd; /* -1 if unused */
+	Bool subscribed;
+	int len;
+	char buf[512]; /* unfinished command line */
+	char *out; /* not yet sent, the socket was full */
+	int outlen, outcap;
+} Ctl; /* control socket connection */
+
+typedef struct {
+	int key; /* three lowercased title bytes, 0 if unused */
+	int n, cap;
+	struct {
+		int id; /* pool slot of a client whose title contains it */
+		int gram; /* index in that client's grams */
+	} *posts;
+} Trigram;
 
 /* function declarations */
+static void addtab(int pos, Client *c, Window w);
+static Bool attach(Window w);
 static void buttonpress(const XEvent *e);
+static void checkrss(void);
 static void cleanup(void);
 static void clientmessage(const XEvent *e);
+static void closeclient(int c);
+static int cmpint(const void *a, const void *b);
 static void configurenotify(const XEvent *e);
 static void configurerequest(const XEvent *e);
 static void createnotify(const XEvent *e);
+static void ctlaccept(void);
+static void ctlclose(Ctl *c);
+static void ctlcmd(Ctl *c, char *line);
+static const char *ctlescape(const char *s);
+static void ctlevent(const char *fmt, ...);
+static void ctlflush(Ctl *c);
+static void ctlprintf(Ctl *c, const char *fmt, ...);
+static void ctlread(Ctl *c);
+static void ctlsend(Ctl *c, const char *buf, int n);
+static void ctlsetup(void);
+static int ctltab(const char *s);
 static void destroynotify(const XEvent *e);
+static void detach(const Arg *arg);
 static void die(const char *errstr, ...);
+static void discard(void);
 static void drawbar(void);
-static void drawtext(const char *text, XftColor col[ColLast]);
+static void drawtext(const char *text, XftColor col[ColLast], Fit *fit);
+static void dumpstats(void);
 static void *ecalloc(size_t n, size_t size);
 static void *erealloc(void *o, size_t size);
 static void expose(const XEvent *e);
+static int findplaceholder(int id);
 static void focus(int c);
 static void focusin(const XEvent *e);
 static void focusonce(const Arg *arg);
 static void focusurgent(const Arg *arg);
+static void forgetspawn(int i);
+static void freeclient(Client *c);
+static void freeze(void);
 static void fullscreen(const Arg *arg);
 static char *getatom(int a);
 static int getclient(Window w);
 static XftColor getcolor(const char *colstr);
-static int getfirsttab(void);
-static Bool gettextprop(Window w, Atom atom, char *text, unsigned int size);
+static long long getms(void);
+static xcb_get_property_cookie_t getprop(Window w, Atom a, Atom type,
+                                         uint32_t len);
+static long long getus(void);
+static XWMHints *getwmhints(Window w);
+static int glyphw(FcChar32 ucs);
+static void grabkeys(Window w);
+static void handlesignals(void);
+static unsigned long hashbytes(const void *p, size_t n, unsigned long h);
+static void hidetab(int c);
+static void indexclients(int from, int to);
+static void indextitle(Client *c, Bool add);
 static void initfont(const char *fontstr);
-static Bool isprotodel(int c);
+static Bool isprotodel(xcb_get_property_reply_t *r);
 static void keypress(const XEvent *e);
 static void keyrelease(const XEvent *e);
 static void killclient(const Arg *arg);
+static void loadsession(void);
 static void manage(Window win);
+static void mappingnotify(const XEvent *e);
 static void maprequest(const XEvent *e);
+static void markdead(Window w);
 static void move(const Arg *arg);
 static void movetab(const Arg *arg);
+static Client *newclient(void);
+static int nexttimeout(void);
+static int pidopen(pid_t pid);
+static void placetab(int from, int to);
+static void pollfds(int timeout);
+static void processdied(pid_t pid);
 static void propertynotify(const XEvent *e);
+static xcb_get_property_reply_t *propreply(xcb_get_property_cookie_t ck);
+static void rehash(unsigned int size);
+static void release(int c, Window to);
 static void resize(int c, int w, int h);
+static void resizesel(void);
 static void rotate(const Arg *arg);
 static void run(void);
+static void runtimers(void);
+static void savesession(void);
 static void sendxembed(int c, long msg, long detail, long d1, long d2);
+static void sessionchanged(void);
 static void setcmd(int argc, char *argv[], int);
+static void settimer(int t, long long when);
 static void setup(void);
-static void sigchld(int unused);
+static void shiftclients(int to, int from, int n);
 static void showbar(const Arg *arg);
+static void showtab(int c);
+static void sighandler(int sig);
 static void spawn(const Arg *arg);
+static void spawntab(int c);
+static Bool superseded(const XEvent *e, const XEvent *later, int n);
+static void switcher(const Arg *arg);
+static void switcherdraw(void);
+static void switcherend(int c);
+static void switcherfilter(void);
+static void switcherkey(const XKeyEvent *ev);
+static int tabat(int x);
+static void textfit(const char *text, int w, Fit *fit);
 static int textnw(const char *text, unsigned int len);
+static Bool textprop(xcb_get_property_reply_t *r, char *text,
+                     unsigned int size);
+static void thaw(int c);
+static Bool titlematch(const char *title, const char *q);
 static void toggle(const Arg *arg);
+static Trigram *trigram(int key, Bool create);
+static void unembed(int c);
+static void unindexclient(Window w);
 static void unmanage(int c);
 static void unmapnotify(const XEvent *e);
+static void unsethidden(int c);
+static void untrigram(int key);
+static void updateicon(int c, xcb_get_property_cookie_t ck[2]);
+static void updatekeys(void);
+static Bool updatelayout(void);
 static void updatenumlockmask(void);
+static void updatestates(void);
 static void updatetitle(int c);
+static void updatetitlefrom(int c, xcb_get_property_cookie_t ck[2]);
+static unsigned int winhash(Window w);
+static XWMHints *wmhints(xcb_get_property_reply_t *r);
+static pid_t wmpid(xcb_get_property_reply_t *p,
+                   xcb_get_property_reply_t *host);
 static int xerror(Display *dpy, XErrorEvent *ee);
-static void xsettitle(Window w, const char *str);
 static void xseticon(void);
+static void xsettitle(Window w, const char *str);
 
 /* variables */
 static int screen;
@@ -154,20 +311,114 @@ static void (*handler[LASTEvent]) (const XEvent *) = {
 	[FocusIn] = focusin,
 	[KeyPress] = keypress,
 	[KeyRelease] = keyrelease,
+	[MappingNotify] = mappingnotify,
 	[MapRequest] = maprequest,
 	[PropertyNotify] = propertynotify,
 };
 static int bh, obh, wx, wy, ww, wh, vbh;
 static unsigned int numlockmask;
+static struct {
+	KeyCode code;
+	unsigned int mod;
+} *grabs; /* passive grabs for every client, see updatekeys() */
+static int ngrabs;
+static Binding *bindings;
+static int keymap[2][257]; /* bindings of [release][keycode] start there */
 static Bool running = True, nextfocus, doinitspawn = True,
             fillagain = False, closelastclient = False,
             killclientsfirst = False;
 static Display *dpy;
+static xcb_connection_t *xc; /* dpy as XCB, to pipeline property reads */
 static DC dc;
 static Atom wmatom[WMLast];
 static Window root, win;
+static Window blank; /* shown for placeholder tabs */
+static Window shown; /* the client that is not hidden, see hidetabs */
 static Client **clients;
-static int nclients, sel = -1, lastsel = -1;
+static struct {
+	Window *win;
+	int *x;
+	Bool *urgent;
+} tab; /* frequently scanned client fields, indexed like clients */
+static int nclients, clientcap, sel = -1, lastsel = -1;
+static Client *freeclients;
+static void **chunks; /* client pool and title arena allocations */
+static int nchunks;
+static WinSlot *wintab;
+static unsigned int wintabsz;
+static Client **slots; /* pool slot to client */
+static int nslots;
+static Trigram *trigrams; /* title index, open addressing */
+static unsigned int trigramsz, ntrigrams;
+static struct {
+	Bool active;
+	Bool barvisibility; /* to restore afterwards */
+	char query[NAMELEN]; /* lowercased */
+	int len;
+	int *match, nmatch; /* tab indices in tab order */
+	int *pos; /* pool slot to tab index */
+	int cap;
+	int cur, curid; /* highlighted match and its pool slot */
+} sw; /* switcher */
+static Bool redrawall = True;
+static Bool deferdraw, drawpending;
+static Bool statesasked; /* some client awaits unsethidden() */
+static long long resizefirst; /* first ConfigureNotify of a resize, in ms */
+static int sigpipe[2]; /* signal handler to event loop */
+static int ctlfd = -1;
+static int psifd = -1; /* memory pressure trigger */
+static char ctlpath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static Ctl ctl[16];
+static int nsubscribed;
+static struct {
+	pid_t pid;
+	int slot; /* pool slot of the placeholder to fill, -1 for a new tab */
+	Bool fromcmd;
+	char *arg;
+} spawned[32]; /* children that did not embed yet, oldest first */
+static int nspawned;
+static int spawnslot = -1; /* placeholder for the next spawn() */
+static char *sessionfile;
+static struct {
+	long long when; /* in ms, 0 if not armed */
+	void (*fn)(void);
+} timers[TimerLast] = {
+	[TimerResize] = { 0, resizesel },
+	[TimerSession] = { 0, savesession },
+	[TimerFreeze] = { 0, freeze },
+	[TimerDiscard] = { 0, checkrss },
+};
+static struct {
+	int fc, cc;     /* first visible tab, number of visible tabs */
+	int x;          /* left border of the first visible tab */
+	int bw, aw;     /* width of the before and after indicators */
+	Bool after;     /* tabs are hidden to the right */
+	int sel, n, w;  /* selection, clients and width laid out for */
+	Bool stale;
+} lay = { .stale = True }; /* tab bar layout */
+static struct {
+	unsigned long redraws;
+	unsigned long xftdraws;
+	unsigned long pixmaps;
+	unsigned long events[LASTEvent];
+	unsigned long roundtrips[LASTEvent]; /* [0]: outside of handlers */
+	unsigned long deaderrors;
+	unsigned long coalesced;
+	unsigned long manages;
+	unsigned long managereqs;
+	unsigned long resizes;
+	unsigned long resizeskips;
+	unsigned long spawns;      /* from a key press or property change */
+	long long spawnus, spawnmax; /* from reading the event to exec */
+	unsigned long discards;
+} stats;
+static int curevent;
+static long long evstart; /* when the handled event was read, showstats only */
+static struct {
+	Window win;
+	unsigned long serial; /* first request issued after unmanage() */
+} dead[64]; /* recently unmanaged clients, see xerror() */
+static unsigned int ndead;
 static int (*xerrorxlib)(Display *, XErrorEvent *);
 static int cmd_append_pos;
 static char winid[64];
@@ -175,45 +426,125 @@ static char **cmd;
 static char *wmname = "tabbed";
 static const char *geometry;
 static Bool barvisibility = False;
+static struct {
+	FcChar32 ucs;
+	int w;
+} glyphs[1024]; /* direct mapped glyph advance cache */
 static unsigned long icon[ICON_WIDTH * ICON_HEIGHT + 2];
+static unsigned long winiconhash; /* icon set on win, 0 if unknown */
+static char emptytitle[BUFSIZ]; /* title of win without clients */
 
 char *argv0;
 
 /* configuration, allows nested code to access above variables */
 #include "config.h"
 
+void
+addtab(int pos, Client *c, Window w)
+{
+	if (nclients == clientcap) {
+		clientcap = clientcap ? clientcap * 2 : 16;
+		clients = erealloc(clients, clientcap * sizeof(*clients));
+		tab.win = erealloc(tab.win, clientcap * sizeof(*tab.win));
+		tab.x = erealloc(tab.x, clientcap * sizeof(*tab.x));
+		tab.urgent = erealloc(tab.urgent,
+		                      clientcap * sizeof(*tab.urgent));
+	}
+	nclients++;
+
+	shiftclients(pos + 1, pos, nclients - pos - 1);
+	clients[pos] = c;
+	tab.win[pos] = w;
+	tab.x[pos] = 0;
+	tab.urgent[pos] = False;
+	/* keep the index at most half full */
+	if ((unsigned int)nclients * 2 > wintabsz)
+		rehash(wintabsz ? wintabsz * 2 : 32);
+	else
+		indexclients(pos, nclients);
+	lay.stale = True;
+	sessionchanged();
+}
+
+/* Adopts a window of another client, as if it was embedded by it. */
+Bool
+attach(Window w)
+{
+	XWindowAttributes wa;
+
+	if (w == win || w == root || getclient(w) > -1)
+		return False;
+	stats.roundtrips[curevent]++;
+	if (!XGetWindowAttributes(dpy, w, &wa))
+		return False;
+	manage(w);
+
+	return True;
+}
+
 void
 buttonpress(const XEvent *e)
 {
 	const XButtonPressedEvent *ev = &e->xbutton;
-	int i, fc;
+	int i;
 	Arg arg;
 
 	if (ev->y < 0 || ev->y > bh)
 		return;
 
-	if (((fc = getfirsttab()) > 0 && ev->x < TEXTW(before)) || ev->x < 0)
+	/* hit test against the same layout drawbar() will paint */
+	if (updatelayout())
+		redrawall = True;
+	if (ev->x < lay.x || (i = tabat(ev->x)) < 0)
 		return;
 
-	for (i = fc; i < nclients; i++) {
-		if (clients[i]->tabx > ev->x) {
-			switch (ev->button) {
-			case Button1:
-				focus(i);
-				break;
-			case Button2:
-				focus(i);
-				killclient(NULL);
-				break;
-			case Button4: /* FALLTHROUGH */
-			case Button5:
-				arg.i = ev->button == Button4 ? -1 : 1;
-				rotate(&arg);
-				break;
-			}
-			break;
-		}
+	switch (ev->button) {
+	case Button1:
+		focus(i);
+		break;
+	case Button2:
+		focus(i);
+		killclient(NULL);
+		break;
+	case Button4: /* FALLTHROUGH */
+	case Button5:
+		arg.i = ev->button == Button4 ? -1 : 1;
+		rotate(&arg);
+		break;
+	}
+}
+
+/* Sums the resident memory of the tabs' processes, not their children. */
+void
+checkrss(void)
+{
+	unsigned long long total = 0;
+	unsigned long size, rss;
+	char path[64];
+	int *pids, c, i, n = 0;
+	FILE *f;
+
+	pids = ecalloc(nclients + 1, sizeof(*pids));
+	for (c = 0; c < nclients; c++) {
+		if (clients[c]->pid)
+			pids[n++] = clients[c]->pid;
+	}
+	qsort(pids, n, sizeof(*pids), cmpint);
+	for (i = 0; i < n; i++) {
+		if (i > 0 && pids[i] == pids[i - 1])
+			continue;
+		snprintf(path, sizeof(path), "/proc/%d/statm", pids[i]);
+		if (!(f = fopen(path, "r")))
+			continue;
+		if (fscanf(f, "%lu %lu", &size, &rss) == 2)
+			total += (unsigned long long)rss * sysconf(_SC_PAGESIZE);
+		fclose(f);
 	}
+	free(pids);
+
+	if (total > (unsigned long long)discardrss << 20)
+		discard();
+	settimer(TimerDiscard, getms() + 5000);
 }
 
 void
@@ -221,20 +552,64 @@ cleanup(void)
 {
 	int i;
 
-	for (i = 0; i < nclients; i++) {
+	if (timers[TimerSession].when)
+		savesession();
+
+	/* from the end, both remove tab i */
+	for (i = nclients - 1; i >= 0; i--) {
+		if (tab.win[i] == None) {
+			unmanage(i);
+			continue;
+		}
 		focus(i);
 		killclient(NULL);
-		XReparentWindow(dpy, clients[i]->win, root, 0, 0);
-		unmanage(i);
+		release(i, root);
 	}
 	free(clients);
 	clients = NULL;
+	free(tab.win);
+	free(tab.x);
+	free(tab.urgent);
+	for (i = 0; i < nslots; i++)
+		free(slots[i]->grams);
+	for (i = 0; i < nchunks; i++)
+		free(chunks[i]);
+	free(chunks);
+	chunks = NULL;
+	freeclients = NULL;
+	free(wintab);
+	wintab = NULL;
+	wintabsz = 0;
+	for (i = 0; i < trigramsz; i++)
+		free(trigrams[i].posts);
+	free(trigrams);
+	trigrams = NULL;
+	trigramsz = ntrigrams = 0;
+	free(slots);
+	slots = NULL;
+	free(sw.match);
+	free(sw.pos);
+	free(grabs);
+	grabs = NULL;
+	free(bindings);
+	bindings = NULL;
+
+	for (i = 0; i < LENGTH(ctl); i++)
+		ctlclose(&ctl[i]);
+	if (ctlfd != -1) {
+		close(ctlfd);
+		unlink(ctlpath);
+	}
 
+	XftDrawDestroy(dc.xftdraw);
 	XFreePixmap(dpy, dc.drawable);
 	XFreeGC(dpy, dc.gc);
 	XDestroyWindow(dpy, win);
 	XSync(dpy, False);
 	free(cmd);
+
+	if (showstats)
+		dumpstats();
 }
 
 void
@@ -252,17 +627,52 @@ clientmessage(const XEvent *e)
 	}
 }
 
+void
+closeclient(int c)
+{
+	XEvent ev;
+
+	thaw(c); /* or it could not react */
+	if (tab.win[c] == None) {
+		unmanage(c);
+	} else if (clients[c]->protodel && !clients[c]->closed) {
+		ev.type = ClientMessage;
+		ev.xclient.window = tab.win[c];
+		ev.xclient.message_type = wmatom[WMProtocols];
+		ev.xclient.format = 32;
+		ev.xclient.data.l[0] = wmatom[WMDelete];
+		ev.xclient.data.l[1] = CurrentTime;
+		XSendEvent(dpy, tab.win[c], False, NoEventMask, &ev);
+		clients[c]->closed = True;
+	} else {
+		XKillClient(dpy, tab.win[c]);
+	}
+}
+
+int
+cmpint(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
 void
 configurenotify(const XEvent *e)
 {
 	const XConfigureEvent *ev = &e->xconfigure;
+	long long now;
 
 	if (ev->window == win && (ev->width != ww || ev->height != wh)) {
 		ww = ev->width;
 		wh = ev->height;
-		XFreePixmap(dpy, dc.drawable);
-		dc.drawable = XCreatePixmap(dpy, root, ww, wh,
-		              DefaultDepth(dpy, screen));
+		if (ww > dc.drawablew) {
+			dc.drawablew = MAX(ww, dc.drawablew + dc.drawablew / 2);
+			XFreePixmap(dpy, dc.drawable);
+			dc.drawable = XCreatePixmap(dpy, root, dc.drawablew,
+			              vbh, DefaultDepth(dpy, screen));
+			XftDrawChange(dc.xftdraw, dc.drawable);
+			stats.pixmaps++;
+		}
+		redrawall = True;
 
 		if (!obh && (wh <= bh)) {
 			obh = bh;
@@ -272,9 +682,18 @@ configurenotify(const XEvent *e)
 			obh = 0;
 		}
 
-		if (sel > -1)
+		if (sel < 0)
+			return;
+		if (resizedelay > 0) {
+			/* resize the client once the container settled */
+			now = getms();
+			if (!timers[TimerResize].when)
+				resizefirst = now;
+			settimer(TimerResize, MIN(now + resizedelay,
+			         resizefirst + resizemaxdelay));
+		} else {
 			resize(sel, ww, wh - bh);
-		XSync(dpy, False);
+		}
 	}
 }
 
@@ -293,7 +712,9 @@ configurerequest(const XEvent *e)
 		wc.border_width = 0;
 		wc.sibling = ev->above;
 		wc.stack_mode = ev->detail;
-		XConfigureWindow(dpy, clients[c]->win, ev->value_mask, &wc);
+		XConfigureWindow(dpy, tab.win[c], ev->value_mask, &wc);
+		if (ev->value_mask & (CWX | CWY | CWWidth | CWHeight))
+			clients[c]->w = -1;
 	}
 }
 
@@ -306,6 +727,306 @@ createnotify(const XEvent *e)
 		manage(ev->window);
 }
 
+void
+ctlaccept(void)
+{
+	unsigned int i;
+	int fd;
+
+	if ((fd = accept(ctlfd, NULL, NULL)) == -1)
+		return;
+	for (i = 0; i < LENGTH(ctl) && ctl[i].fd != -1; i++)
+		;
+	if (i == LENGTH(ctl)) {
+		close(fd);
+		return;
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	ctl[i].fd = fd;
+	ctl[i].subscribed = False;
+	ctl[i].len = 0;
+}
+
+void
+ctlclose(Ctl *c)
+{
+	if (c->fd == -1)
+		return;
+	close(c->fd);
+	c->fd = -1;
+	free(c->out);
+	c->out = NULL;
+	c->outlen = c->outcap = 0;
+	if (c->subscribed)
+		nsubscribed--;
+	c->subscribed = False;
+}
+
+void
+ctlcmd(Ctl *c, char *line)
+{
+	char *arg, *pos = NULL;
+	int i, t;
+	Window w;
+	XWindowAttributes wa;
+	Arg a;
+
+	if ((arg = strchr(line, ' ')))
+		*arg++ = '\0';
+
+	if (!strcmp(line, "list")) {
+		for (i = 0; i < nclients; i++)
+			ctlprintf(c, "%d 0x%lx %c %s\n", i, tab.win[i],
+			          i == sel ? '*' : tab.urgent[i] ? '!' : '-',
+			          ctlescape(clients[i]->name));
+	} else if (!strcmp(line, "select")) {
+		if ((t = ctltab(arg)) < 0) {
+			ctlprintf(c, "error no such tab\n");
+			return;
+		}
+		focus(t);
+	} else if (!strcmp(line, "move")) {
+		if (!arg || !(pos = strchr(arg, ' '))) {
+			ctlprintf(c, "error usage: move tab position\n");
+			return;
+		}
+		*pos++ = '\0';
+		i = ctltab(pos);
+		if ((t = ctltab(arg)) < 0 || i < 0 || !strncmp(pos, "0x", 2)) {
+			ctlprintf(c, "error no such tab\n");
+			return;
+		}
+		placetab(t, i);
+	} else if (!strcmp(line, "close")) {
+		if ((t = ctltab(arg)) < 0) {
+			ctlprintf(c, "error no such tab\n");
+			return;
+		}
+		closeclient(t);
+	} else if (!strcmp(line, "detach")) {
+		if (arg && (pos = strchr(arg, ' ')))
+			*pos++ = '\0';
+		if ((t = ctltab(arg)) < 0) {
+			ctlprintf(c, "error no such tab\n");
+			return;
+		}
+		w = pos ? strtoul(pos, NULL, 0) : root;
+		stats.roundtrips[curevent]++;
+		if (w == win || tab.win[t] == None ||
+		    !XGetWindowAttributes(dpy, w, &wa)) {
+			ctlprintf(c, "error bad window\n");
+			return;
+		}
+		release(t, w);
+	} else if (!strcmp(line, "attach")) {
+		if (!arg || !attach(strtoul(arg, NULL, 0))) {
+			ctlprintf(c, "error bad window\n");
+			return;
+		}
+	} else if (!strcmp(line, "spawn")) {
+		if (!cmd[0]) {
+			ctlprintf(c, "error no command\n");
+			return;
+		}
+		if (arg) {
+			cmd[cmd_append_pos] = arg;
+			a.v = cmd;
+			spawn(&a);
+			cmd[cmd_append_pos] = NULL;
+		} else {
+			spawn(NULL);
+		}
+	} else if (!strcmp(line, "subscribe")) {
+		if (!c->subscribed)
+			nsubscribed++;
+		c->subscribed = True;
+	} else {
+		ctlprintf(c, "error unknown command %s\n", line);
+		return;
+	}
+	ctlprintf(c, "ok\n");
+}
+
+/* Escapes backslashes and newlines, the protocol is line based. */
+const char *
+ctlescape(const char *s)
+{
+	static char buf[NAMELEN * 2];
+	char *p = buf;
+
+	for (; *s; s++) {
+		if (*s == '\\' || *s == '\n')
+			*p++ = '\\';
+		*p++ = *s == '\n' ? 'n' : *s;
+	}
+	*p = '\0';
+
+	return buf;
+}
+
+void
+ctlevent(const char *fmt, ...)
+{
+	char buf[BUFSIZ] = "event ";
+	unsigned int i;
+	va_list ap;
+	int n;
+
+	if (!nsubscribed)
+		return;
+
+	va_start(ap, fmt);
+	n = vsnprintf(&buf[6], sizeof(buf) - 6, fmt, ap) + 6;
+	va_end(ap);
+	for (i = 0; i < LENGTH(ctl); i++) {
+		if (!ctl[i].subscribed)
+			continue;
+		/* a subscriber that does not read is dropped */
+		if (ctl[i].outlen > CTLBACKLOG)
+			ctlclose(&ctl[i]);
+		else
+			ctlsend(&ctl[i], buf, n);
+	}
+}
+
+void
+ctlflush(Ctl *c)
+{
+	ssize_t n;
+
+	n = send(c->fd, c->out, c->outlen, MSG_NOSIGNAL);
+	if (n == -1 && errno != EAGAIN && errno != EINTR) {
+		ctlclose(c);
+		return;
+	} else if (n == -1) {
+		return;
+	}
+	c->outlen -= n;
+	memmove(c->out, &c->out[n], c->outlen);
+}
+
+void
+ctlprintf(Ctl *c, const char *fmt, ...)
+{
+	char buf[BUFSIZ];
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	ctlsend(c, buf, n);
+}
+
+void
+ctlread(Ctl *c)
+{
+	char *line, *nl;
+	ssize_t n;
+
+	n = read(c->fd, &c->buf[c->len], sizeof(c->buf) - c->len);
+	if (n == 0 || (n == -1 && errno != EAGAIN && errno != EINTR)) {
+		ctlclose(c);
+		return;
+	} else if (n == -1) {
+		return;
+	}
+
+	c->len += n;
+	line = c->buf;
+	while (c->fd != -1 &&
+	       (nl = memchr(line, '\n', &c->buf[c->len] - line))) {
+		*nl = '\0';
+		ctlcmd(c, line);
+		line = nl + 1;
+	}
+	if (c->fd == -1)
+		return;
+
+	c->len -= line - c->buf;
+	memmove(c->buf, line, c->len);
+	if (c->len == sizeof(c->buf)) {
+		ctlprintf(c, "error line too long\n");
+		ctlclose(c);
+	}
+}
+
+/* What the socket does not take now is sent by ctlflush() later. */
+void
+ctlsend(Ctl *c, const char *buf, int n)
+{
+	if (c->fd == -1)
+		return;
+	if (n >= BUFSIZ)
+		n = BUFSIZ - 1; /* truncated by vsnprintf */
+	if (c->outlen + n > c->outcap) {
+		c->outcap = MAX(c->outcap * 2, c->outlen + n);
+		c->out = erealloc(c->out, c->outcap);
+	}
+	memcpy(&c->out[c->outlen], buf, n);
+	c->outlen += n;
+	ctlflush(c);
+}
+
+void
+ctlsetup(void)
+{
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	const char *dir;
+	mode_t mask;
+	int n;
+
+	if ((dir = getenv("XDG_RUNTIME_DIR")))
+		n = snprintf(sa.sun_path, sizeof(sa.sun_path),
+		             "%s/tabbed-0x%lx", dir, win);
+	else
+		n = snprintf(sa.sun_path, sizeof(sa.sun_path),
+		             "/tmp/tabbed-%d-0x%lx", (int)getuid(), win);
+	if (n < 0 || n >= sizeof(sa.sun_path)) {
+		fprintf(stderr, "%s: control socket path too long\n", argv0);
+		return;
+	}
+
+	if ((ctlfd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		fprintf(stderr, "%s: cannot create control socket: %s\n",
+		        argv0, strerror(errno));
+		return;
+	}
+	mask = umask(077);
+	n = bind(ctlfd, (struct sockaddr *)&sa, sizeof(sa));
+	umask(mask);
+	if (n == -1 || listen(ctlfd, LENGTH(ctl)) == -1) {
+		fprintf(stderr, "%s: cannot listen on %s: %s\n", argv0,
+		        sa.sun_path, strerror(errno));
+		close(ctlfd);
+		ctlfd = -1;
+		return;
+	}
+	fcntl(ctlfd, F_SETFD, FD_CLOEXEC);
+	fcntl(ctlfd, F_SETFL, O_NONBLOCK);
+	memcpy(ctlpath, sa.sun_path, sizeof(ctlpath));
+	setenv("TABBED_SOCKET", ctlpath, 1);
+}
+
+/* A tab is given by its index or its window id in hex, none is sel. */
+int
+ctltab(const char *s)
+{
+	unsigned long v;
+	char *end;
+
+	if (!s || !*s)
+		return sel;
+	v = strtoul(s, &end, 0);
+	if (*end)
+		return -1;
+	if (!strncmp(s, "0x", 2))
+		return getclient(v);
+
+	return v < (unsigned long)nclients ? (int)v : -1;
+}
+
 void
 destroynotify(const XEvent *e)
 {
@@ -316,6 +1037,13 @@ destroynotify(const XEvent *e)
 		unmanage(c);
 }
 
+void
+detach(const Arg *arg)
+{
+	if (sel > -1 && tab.win[sel] != None)
+		release(sel, root);
+}
+
 void
 die(const char *errstr, ...)
 {
@@ -327,76 +1055,122 @@ die(const char *errstr, ...)
 	exit(EXIT_FAILURE);
 }
 
+/*
+ * Closes the least recently used background tab that can be started again
+ * and keeps it as a placeholder. Tabs sharing their process are kept.
+ */
+void
+discard(void)
+{
+	int c, o, victim = -1;
+
+	for (c = 0; c < nclients; c++) {
+		if (c == sel || tab.win[c] == None || !clients[c]->fromcmd ||
+		    !clients[c]->pid || tab.urgent[c] ||
+		    (victim > -1 && clients[c]->idle >= clients[victim]->idle))
+			continue;
+		for (o = 0; o < nclients; o++) {
+			if (o != c && clients[o]->pid == clients[c]->pid)
+				break;
+		}
+		if (o == nclients)
+			victim = c;
+	}
+	if (victim < 0)
+		return;
+
+	thaw(victim);
+	XKillClient(dpy, tab.win[victim]);
+	kill(clients[victim]->pid, SIGTERM);
+	unembed(victim);
+	stats.discards++;
+}
+
 void
 drawbar(void)
 {
 	XftColor *col;
-	int c, cc, fc, width, nbh;
-	char *name = NULL;
+	int c, nbh;
+	Bool full;
+
+	/* while an event batch is handled, draw once at its end */
+	if (deferdraw) {
+		drawpending = True;
+		return;
+	}
+	drawpending = False;
 
 	nbh = barvisibility ? vbh : 0;
 	if (nbh != bh) {
 		bh = nbh;
-		for (c = 0; c < nclients; c++)
-			XMoveResizeWindow(dpy, clients[c]->win, 0, bh, ww, wh-bh);
+		XMoveWindow(dpy, blank, 0, bh);
+		for (c = 0; c < nclients; c++) {
+			if (tab.win[c] == None)
+				continue;
+			XMoveResizeWindow(dpy, tab.win[c], 0, bh, ww, wh-bh);
+			clients[c]->y = bh;
+			clients[c]->w = ww;
+			clients[c]->h = wh - bh;
+		}
+		redrawall = True;
 	}
 
 	if (bh == 0) return;
 
+	stats.redraws++;
+	if (sw.active) {
+		switcherdraw();
+		return;
+	}
 	if (nclients == 0) {
 		dc.x = 0;
 		dc.w = ww;
-		XFetchName(dpy, win, &name);
-		drawtext(name ? name : "", dc.norm);
+		drawtext(emptytitle, dc.norm, NULL);
 		XCopyArea(dpy, dc.drawable, win, dc.gc, 0, 0, ww, bh, 0, 0);
-		XSync(dpy, False);
+		redrawall = True;
 
 		return;
 	}
 
-	width = ww;
-	cc = ww / tabwidth;
-	if (nclients > cc)
-		cc = (ww - TEXTW(before) - TEXTW(after)) / tabwidth;
-
-	if ((fc = getfirsttab()) + cc < nclients) {
-		dc.w = TEXTW(after);
-		dc.x = width - dc.w;
-		drawtext(after, dc.sel);
-		width -= dc.w;
+	full = updatelayout() || redrawall;
+	if (full && lay.after) {
+		dc.w = lay.aw;
+		dc.x = ww - dc.w;
+		drawtext(after, dc.sel, NULL);
 	}
-	dc.x = 0;
-
-	if (fc > 0) {
-		dc.w = TEXTW(before);
-		drawtext(before, dc.sel);
-		dc.x += dc.w;
-		width -= dc.w;
+	if (full && lay.fc > 0) {
+		dc.x = 0;
+		dc.w = lay.bw;
+		drawtext(before, dc.sel, NULL);
 	}
 
-	cc = MIN(cc, nclients);
-	for (c = fc; c < fc + cc; c++) {
-		dc.w = width / cc;
-		if (c == sel) {
+	/* without a relayout only the damaged tabs are repainted */
+	for (c = lay.fc; c < lay.fc + lay.cc; c++) {
+		if (!full && !clients[c]->dirty)
+			continue;
+		if (c == sel)
 			col = dc.sel;
-			dc.w += width % cc;
-		} else {
-			col = clients[c]->urgent ? dc.urg : dc.norm;
-		}
-		drawtext(clients[c]->name, col);
-		dc.x += dc.w;
-		clients[c]->tabx = dc.x;
+		else
+			col = tab.urgent[c] ? dc.urg : dc.norm;
+		dc.x = c > lay.fc ? tab.x[c - 1] : lay.x;
+		dc.w = tab.x[c] - dc.x;
+		drawtext(clients[c]->name, col, &clients[c]->fit);
+		if (!full)
+			XCopyArea(dpy, dc.drawable, win, dc.gc, dc.x, 0,
+			          dc.w, bh, dc.x, 0);
+		clients[c]->dirty = False;
 	}
-	XCopyArea(dpy, dc.drawable, win, dc.gc, 0, 0, ww, bh, 0, 0);
-	XSync(dpy, False);
+	if (full)
+		XCopyArea(dpy, dc.drawable, win, dc.gc, 0, 0, ww, bh, 0, 0);
+	redrawall = False;
 }
 
 void
-drawtext(const char *text, XftColor col[ColLast])
+drawtext(const char *text, XftColor col[ColLast], Fit *fit)
 {
-	int i, j, x, y, h, len, olen;
-	char buf[256];
-	XftDraw *d;
+	int x, y, h, len;
+	char buf[256 + sizeof(titletrim)];
+	Fit f = { .len = -1 };
 	XRectangle r = { dc.x, dc.y, dc.w, dc.h };
 
 	XSetForeground(dpy, dc.gc, col[ColBG].pixel);
@@ -404,28 +1178,61 @@ drawtext(const char *text, XftColor col[ColLast])
 	if (!text)
 		return;
 
-	olen = strlen(text);
 	h = dc.font.ascent + dc.font.descent;
 	y = dc.y + (dc.h / 2) - (h / 2) + dc.font.ascent;
 	x = dc.x + (h / 2);
 
 	/* shorten text if necessary */
-	for (len = MIN(olen, sizeof(buf));
-		len && textnw(text, len) > dc.w - h; len--);
-
-	if (!len)
+	if (!fit)
+		fit = &f;
+	if (fit->len < 0 || fit->w != dc.w - h)
+		textfit(text, dc.w - h, fit);
+
+	if (!fit->trim) {
+		if (fit->len)
+			XftDrawStringUtf8(dc.xftdraw, &col[ColFG], dc.font.xfont,
+			                  x, y, (XftChar8 *) text, fit->len);
 		return;
-
-	memcpy(buf, text, len);
-	if (len < olen) {
-		for (i = len, j = strlen(titletrim); j && i;
-		     buf[--i] = titletrim[--j])
-			;
 	}
 
-	d = XftDrawCreate(dpy, dc.drawable, DefaultVisual(dpy, screen), DefaultColormap(dpy, screen));
-	XftDrawStringUtf8(d, &col[ColFG], dc.font.xfont, x, y, (XftChar8 *) buf, len);
-	XftDrawDestroy(d);
+	len = strlen(titletrim);
+	memcpy(buf, text, fit->len);
+	memcpy(&buf[fit->len], titletrim, len);
+	XftDrawStringUtf8(dc.xftdraw, &col[ColFG], dc.font.xfont, x, y,
+	                  (XftChar8 *) buf, fit->len + len);
+}
+
+void
+dumpstats(void)
+{
+	int i;
+
+	fprintf(stderr, "%s: %lu bar redraws, %lu XftDraw contexts created, "
+	        "%lu pixmaps allocated\n", argv0, stats.redraws,
+	        stats.xftdraws, stats.pixmaps);
+	fprintf(stderr, "%s: %lu round trips outside of event handlers\n",
+	        argv0, stats.roundtrips[0]);
+	for (i = 2; i < LASTEvent; i++) {
+		if (stats.events[i])
+			fprintf(stderr, "%s: event %d: %lu handled, "
+			        "%lu round trips\n", argv0, i,
+			        stats.events[i], stats.roundtrips[i]);
+	}
+	fprintf(stderr, "%s: %lu superseded events skipped\n",
+	        argv0, stats.coalesced);
+	fprintf(stderr, "%s: %lu clients managed, %lu requests each\n",
+	        argv0, stats.manages,
+	        stats.manages ? stats.managereqs / stats.manages : 0);
+	fprintf(stderr, "%s: %lu client resizes, %lu unchanged ones skipped\n",
+	        argv0, stats.resizes, stats.resizeskips);
+	fprintf(stderr, "%s: %lu errors on unmanaged windows ignored\n",
+	        argv0, stats.deaderrors);
+	fprintf(stderr, "%s: %lu spawns, %lld us average, %lld us max "
+	        "from event to exec\n", argv0, stats.spawns,
+	        stats.spawns ? stats.spawnus / (long long)stats.spawns : 0,
+	        stats.spawnmax);
+	fprintf(stderr, "%s: %lu tabs discarded under memory pressure\n",
+	        argv0, stats.discards);
 }
 
 void *
@@ -453,26 +1260,44 @@ expose(const XEvent *e)
 {
 	const XExposeEvent *ev = &e->xexpose;
 
-	if (ev->count == 0 && win == ev->window)
+	if (ev->count == 0 && win == ev->window) {
+		redrawall = True;
 		drawbar();
+	}
+}
+
+int
+findplaceholder(int id)
+{
+	int c;
+
+	for (c = 0; id > -1 && c < nclients; c++) {
+		if (clients[c]->id == id && tab.win[c] == None)
+			return c;
+	}
+
+	return -1;
 }
 
 void
 focus(int c)
 {
-	char buf[BUFSIZ] = "tabbed-"VERSION" ::";
 	size_t i, n;
+	int o;
 	XWMHints* wmh;
 
 	/* If c, sel and clients are -1, raise tabbed-win itself */
 	if (nclients == 0) {
 		cmd[cmd_append_pos] = NULL;
-		for(i = 0, n = strlen(buf); cmd[i] && n < sizeof(buf); i++)
-			n += snprintf(&buf[n], sizeof(buf) - n, " %s", cmd[i]);
+		n = snprintf(emptytitle, sizeof(emptytitle), "tabbed-"VERSION" ::");
+		for(i = 0; cmd[i] && n < sizeof(emptytitle); i++)
+			n += snprintf(&emptytitle[n], sizeof(emptytitle) - n,
+			              " %s", cmd[i]);
 
-		xsettitle(win, buf);
+		xsettitle(win, emptytitle);
 		XChangeProperty(dpy, win, wmatom[WMIcon], XA_CARDINAL, 32,
 		                PropModeReplace, (unsigned char *) icon, ICON_WIDTH * ICON_HEIGHT + 2);
+		winiconhash = 0;
 		XRaiseWindow(dpy, win);
 
 		return;
@@ -481,28 +1306,50 @@ focus(int c)
 	if (c < 0 || c >= nclients)
 		return;
 
-	resize(c, ww, wh - bh);
-	XRaiseWindow(dpy, clients[c]->win);
-	XSetInputFocus(dpy, clients[c]->win, RevertToParent, CurrentTime);
-	sendxembed(c, XEMBED_FOCUS_IN, XEMBED_FOCUS_CURRENT, 0, 0);
-	sendxembed(c, XEMBED_WINDOW_ACTIVATE, 0, 0, 0);
+	if (tab.win[c] == None) {
+		/* an empty client area until the command embeds */
+		XRaiseWindow(dpy, blank);
+		XSetInputFocus(dpy, win, RevertToParent, CurrentTime);
+		spawntab(c);
+	} else {
+		thaw(c);
+		resize(c, ww, wh - bh);
+		showtab(c);
+		XRaiseWindow(dpy, tab.win[c]);
+		XSetInputFocus(dpy, tab.win[c], RevertToParent, CurrentTime);
+		sendxembed(c, XEMBED_FOCUS_IN, XEMBED_FOCUS_CURRENT, 0, 0);
+		sendxembed(c, XEMBED_WINDOW_ACTIVATE, 0, 0, 0);
+	}
+	/* after the new one is mapped, so nothing flashes */
+	if (hidetabs && shown != tab.win[c]) {
+		if ((o = getclient(shown)) > -1)
+			hidetab(o);
+		shown = tab.win[c];
+	}
 	xsettitle(win, clients[c]->name);
 
 	if (sel != c) {
+		if (sel > -1 && sel < nclients)
+			clients[sel]->idle = getms();
+		if (freezedelay && !timers[TimerFreeze].when)
+			settimer(TimerFreeze, getms() + freezedelay * 1000LL);
 		lastsel = sel;
 		sel = c;
+		ctlevent("select %d 0x%lx\n", c, tab.win[c]);
+		sessionchanged();
 	}
-	xseticon();
+	if (tab.win[c] != None)
+		xseticon();
 
-	if (clients[c]->urgent && (wmh = XGetWMHints(dpy, clients[c]->win))) {
+	if (tab.urgent[c] && (wmh = getwmhints(tab.win[c]))) {
 		wmh->flags &= ~XUrgencyHint;
-		XSetWMHints(dpy, clients[c]->win, wmh);
-		clients[c]->urgent = False;
+		XSetWMHints(dpy, tab.win[c], wmh);
+		tab.urgent[c] = False;
+		clients[c]->dirty = True;
 		XFree(wmh);
 	}
 
 	drawbar();
-	XSync(dpy, False);
 }
 
 void
@@ -514,6 +1361,7 @@ focusin(const XEvent *e)
 
 	if (ev->mode != NotifyUngrab) {
 		XGetInputFocus(dpy, &focused, &dummy);
+		stats.roundtrips[curevent]++;
 		if (focused == win)
 			focus(sel);
 	}
@@ -534,13 +1382,80 @@ focusurgent(const Arg *arg)
 		return;
 
 	for (c = (sel + 1) % nclients; c != sel; c = (c + 1) % nclients) {
-		if (clients[c]->urgent) {
+		if (tab.urgent[c]) {
 			focus(c);
 			return;
 		}
 	}
 }
 
+void
+forgetspawn(int i)
+{
+	int c;
+
+	/* its placeholder can be started again */
+	if ((c = findplaceholder(spawned[i].slot)) > -1)
+		clients[c]->spawning = False;
+	free(spawned[i].arg);
+	nspawned--;
+	memmove(&spawned[i], &spawned[i + 1],
+	        (nspawned - i) * sizeof(*spawned));
+}
+
+void
+freeclient(Client *c)
+{
+	if (c->stateasked)
+		xcb_discard_reply(xc, c->stateck.sequence);
+	free(c->icon);
+	c->icon = NULL;
+	if (c->pid && c->pidfd != -1)
+		close(c->pidfd);
+	free(c->arg);
+	c->arg = NULL;
+	c->next = freeclients;
+	freeclients = c;
+}
+
+/*
+ * Stops the processes of tabs that were in the background for freezedelay
+ * seconds, unless another of their tabs is still in use.
+ */
+void
+freeze(void)
+{
+	long long now = getms(), next = 0, t;
+	int c, o;
+
+	for (c = 0; c < nclients; c++) {
+		if (c == sel || !clients[c]->pid || clients[c]->frozen ||
+		    clients[c]->nofreeze || tab.urgent[c])
+			continue;
+		t = clients[c]->idle + freezedelay * 1000LL;
+		for (o = 0; o < nclients; o++) {
+			if (clients[o]->pid != clients[c]->pid || o == c)
+				continue;
+			if (o == sel || clients[o]->nofreeze || tab.urgent[o])
+				break;
+			t = MAX(t, clients[o]->idle + freezedelay * 1000LL);
+		}
+		if (o < nclients)
+			continue;
+		if (t > now) {
+			next = next ? MIN(next, t) : t;
+			continue;
+		}
+		if (kill(clients[c]->pid, SIGSTOP) == -1)
+			continue;
+		for (o = 0; o < nclients; o++) {
+			if (clients[o]->pid == clients[c]->pid)
+				clients[o]->frozen = True;
+		}
+	}
+	settimer(TimerFreeze, next);
+}
+
 void
 fullscreen(const Arg *arg)
 {
@@ -567,6 +1482,7 @@ getatom(int a)
 
 	XGetWindowProperty(dpy, win, wmatom[a], 0L, BUFSIZ, False, XA_STRING,
 	                   &adummy, &idummy, &ldummy, &ldummy, &p);
+	stats.roundtrips[curevent]++;
 	if (p)
 		strncpy(buf, (char *)p, LENGTH(buf)-1);
 	else
@@ -579,11 +1495,15 @@ getatom(int a)
 int
 getclient(Window w)
 {
-	int i;
+	unsigned int i, mask;
+
+	if (!wintabsz || w == None)
+		return -1;
 
-	for (i = 0; i < nclients; i++) {
-		if (clients[i]->win == w)
-			return i;
+	mask = wintabsz - 1;
+	for (i = winhash(w) & mask; wintab[i].win != None; i = (i + 1) & mask) {
+		if (wintab[i].win == w)
+			return wintab[i].c;
 	}
 
 	return -1;
@@ -600,50 +1520,189 @@ getcolor(const char *colstr)
 	return color;
 }
 
+long long
+getms(void)
+{
+	return getus() / 1000;
+}
+
+/* Only sends the request, propreply() waits for the reply. */
+xcb_get_property_cookie_t
+getprop(Window w, Atom a, Atom type, uint32_t len)
+{
+	return xcb_get_property(xc, 0, w, a, type, 0, len);
+}
+
+long long
+getus(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+XWMHints *
+getwmhints(Window w)
+{
+	stats.roundtrips[curevent]++;
+	return wmhints(propreply(getprop(w, XA_WM_HINTS, XA_WM_HINTS, 9)));
+}
+
 int
-getfirsttab(void)
+glyphw(FcChar32 ucs)
 {
-	int cc, ret;
+	XGlyphInfo ext;
+	unsigned int i = ucs & (LENGTH(glyphs) - 1);
 
-	if (sel < 0)
-		return 0;
+	if (glyphs[i].ucs != ucs || !ucs) {
+		XftTextExtents32(dpy, dc.font.xfont, &ucs, 1, &ext);
+		glyphs[i].ucs = ucs;
+		glyphs[i].w = ext.xOff;
+	}
 
-	cc = ww / tabwidth;
-	if (nclients > cc)
-		cc = (ww - TEXTW(before) - TEXTW(after)) / tabwidth;
+	return glyphs[i].w;
+}
 
-	ret = sel - cc / 2 + (cc + 1) % 2;
-	return ret < 0 ? 0 :
-	       ret + cc > nclients ? MAX(0, nclients - cc) :
-	       ret;
+void
+grabkeys(Window w)
+{
+	int i;
+
+	for (i = 0; i < ngrabs; i++)
+		XGrabKey(dpy, grabs[i].code, grabs[i].mod, w, True,
+		         GrabModeAsync, GrabModeAsync);
 }
 
-Bool
-gettextprop(Window w, Atom atom, char *text, unsigned int size)
+void
+handlesignals(void)
 {
-	char **list = NULL;
-	int n;
-	XTextProperty name;
+	unsigned char sig[64];
+	ssize_t i, n;
+	pid_t pid;
+
+	while ((n = read(sigpipe[0], sig, sizeof(sig))) > 0) {
+		for (i = 0; i < n; i++) {
+			if (sig[i] == SIGCHLD)
+				while ((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+					processdied(pid);
+			else if (sig[i] == SIGTERM)
+				running = False;
+		}
+	}
+}
 
-	if (!text || size == 0)
-		return False;
+unsigned long
+hashbytes(const void *p, size_t n, unsigned long h)
+{
+	const unsigned char *b = p;
 
-	text[0] = '\0';
-	XGetTextProperty(dpy, w, &name, atom);
-	if (!name.nitems)
-		return False;
+	/* FNV-1a */
+	while (n--)
+		h = (h ^ *b++) * 0x100000001b3UL;
 
-	if (name.encoding == XA_STRING) {
-		strncpy(text, (char *)name.value, size - 1);
-	} else if (XmbTextPropertyToTextList(dpy, &name, &list, &n) >= Success
-	           && n > 0 && *list) {
-		strncpy(text, *list, size - 1);
-		XFreeStringList(list);
+	return h;
+}
+
+/*
+ * Tells a background client that it is not visible, so it can stop drawing,
+ * and unmaps it with hidetabs > 1. showtab() undoes it.
+ */
+void
+hidetab(int c)
+{
+	Client *cl;
+
+	if (!hidetabs || c < 0 || tab.win[c] == None || clients[c]->hidden)
+		return;
+	unsethidden(c); /* shown in this very batch */
+	cl = clients[c];
+	cl->hidden = True;
+	sendxembed(c, XEMBED_FOCUS_OUT, 0, 0, 0);
+	sendxembed(c, XEMBED_WINDOW_DEACTIVATE, 0, 0, 0);
+	XChangeProperty(dpy, tab.win[c], wmatom[WMState], XA_ATOM, 32,
+	                PropModeAppend, (unsigned char *)&wmatom[WMHidden], 1);
+	if (hidetabs > 1) {
+		cl->unmaps++;
+		XUnmapWindow(dpy, tab.win[c]);
 	}
-	text[size - 1] = '\0';
-	XFree(name.value);
+}
 
-	return True;
+void
+indexclients(int from, int to)
+{
+	unsigned int i, mask = wintabsz - 1;
+	int c;
+
+	/* (re)insert clients[from..to), their indices may have shifted */
+	for (c = from; c < to; c++) {
+		if (tab.win[c] == None)
+			continue; /* placeholder */
+		for (i = winhash(tab.win[c]) & mask;
+		     wintab[i].win != None && wintab[i].win != tab.win[c];
+		     i = (i + 1) & mask)
+			;
+		wintab[i].win = tab.win[c];
+		wintab[i].c = c;
+	}
+}
+
+/*
+ * Adds the client under each distinct trigram of its title, or removes it
+ * from the posting lists it was added to, by position.
+ */
+void
+indextitle(Client *c, Bool add)
+{
+	int keys[NAMELEN];
+	int i, j, n;
+	const unsigned char *s = (unsigned char *)c->name;
+	Trigram *t;
+	Client *o;
+
+	if (!add) {
+		for (i = 0; i < c->ngrams; i++) {
+			t = trigram(c->grams[i].key, False);
+			j = c->grams[i].pos;
+			/* the last one takes its place */
+			t->posts[j] = t->posts[--t->n];
+			if (j < t->n) {
+				o = slots[t->posts[j].id];
+				o->grams[t->posts[j].gram].pos = j;
+			} else if (!t->n) {
+				untrigram(t->key);
+			}
+		}
+		c->ngrams = 0;
+		return;
+	}
+
+	for (n = 0; s[n] && s[n + 1] && s[n + 2]; n++)
+		keys[n] = LOWER(s[n]) << 16 | LOWER(s[n + 1]) << 8 |
+		          LOWER(s[n + 2]);
+	qsort(keys, n, sizeof(*keys), cmpint);
+	for (i = j = 0; i < n; i++) {
+		if (!j || keys[i] != keys[j - 1])
+			keys[j++] = keys[i];
+	}
+	n = j;
+	if (n > c->gramcap) {
+		c->gramcap = n;
+		c->grams = erealloc(c->grams, n * sizeof(*c->grams));
+	}
+
+	for (i = 0; i < n; i++) {
+		t = trigram(keys[i], True);
+		if (t->n == t->cap) {
+			t->cap = t->cap ? t->cap * 2 : 4;
+			t->posts = erealloc(t->posts,
+			                    t->cap * sizeof(*t->posts));
+		}
+		t->posts[t->n].id = c->id;
+		t->posts[t->n].gram = c->ngrams;
+		c->grams[c->ngrams].key = keys[i];
+		c->grams[c->ngrams++].pos = t->n++;
+	}
 }
 
 void
@@ -659,19 +1718,21 @@ initfont(const char *fontstr)
 }
 
 Bool
-isprotodel(int c)
+isprotodel(xcb_get_property_reply_t *r)
 {
+	uint32_t *protocols;
 	int i, n;
-	Atom *protocols;
 	Bool ret = False;
 
-	if (XGetWMProtocols(dpy, clients[c]->win, &protocols, &n)) {
+	if (r && r->type == XA_ATOM && r->format == 32) {
+		protocols = xcb_get_property_value(r);
+		n = r->value_len;
 		for (i = 0; !ret && i < n; i++) {
 			if (protocols[i] == wmatom[WMDelete])
 				ret = True;
 		}
-		XFree(protocols);
 	}
+	free(r);
 
 	return ret;
 }
@@ -680,15 +1741,16 @@ void
 keypress(const XEvent *e)
 {
 	const XKeyEvent *ev = &e->xkey;
-	unsigned int i;
-	KeySym keysym;
+	int i;
+
+	if (sw.active) {
+		switcherkey(ev);
+		return;
+	}
 
-	keysym = XkbKeycodeToKeysym(dpy, (KeyCode)ev->keycode, 0, 0);
-	for (i = 0; i < LENGTH(keys); i++) {
-		if (keysym == keys[i].keysym &&
-		    CLEANMASK(keys[i].mod) == CLEANMASK(ev->state) &&
-		    keys[i].func)
-			keys[i].func(&(keys[i].arg));
+	for (i = keymap[0][ev->keycode]; i < keymap[0][ev->keycode + 1]; i++) {
+		if (bindings[i].mod == CLEANMASK(ev->state))
+			bindings[i].key->func(&(bindings[i].key->arg));
 	}
 }
 
@@ -696,127 +1758,218 @@ void
 keyrelease(const XEvent *e)
 {
 	const XKeyEvent *ev = &e->xkey;
-	unsigned int i;
-	KeySym keysym;
+	int i;
 
-	keysym = XkbKeycodeToKeysym(dpy, (KeyCode)ev->keycode, 0, 0);
-	for (i = 0; i < LENGTH(keyreleases); i++) {
-		if (keysym == keyreleases[i].keysym &&
-		    CLEANMASK(keyreleases[i].mod) == CLEANMASK(ev->state) &&
-		    keyreleases[i].func)
-			keyreleases[i].func(&(keyreleases[i].arg));
+	for (i = keymap[1][ev->keycode]; i < keymap[1][ev->keycode + 1]; i++) {
+		if (bindings[i].mod == CLEANMASK(ev->state))
+			bindings[i].key->func(&(bindings[i].key->arg));
 	}
 }
 
 void
 killclient(const Arg *arg)
 {
-	XEvent ev;
+	if (sel > -1)
+		closeclient(sel);
+}
 
-	if (sel < 0)
+/* One tab per line: '*' for the selected one or '-', title and argument,
+ * separated by tabs. */
+void
+loadsession(void)
+{
+	char line[BUFSIZ], *title, *arg;
+	int selected = 0;
+	Client *c;
+	FILE *f;
+
+	if (!cmd[0] || !(f = fopen(sessionfile, "r")))
 		return;
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\n")] = '\0';
+		if (!(title = strchr(line, '\t')) ||
+		    !(arg = strchr(title + 1, '\t')))
+			continue;
+		*title++ = '\0';
+		*arg++ = '\0';
+
+		c = newclient();
+		snprintf(c->name, NAMELEN, "%s", title);
+		indextitle(c, True);
+		c->fromcmd = True;
+		if (*arg)
+			c->arg = strcpy(ecalloc(strlen(arg) + 1, 1), arg);
+		if (line[0] == '*')
+			selected = nclients;
+		addtab(nclients, c, None);
+	}
+	fclose(f);
 
-	if (isprotodel(sel) && !clients[sel]->closed) {
-		ev.type = ClientMessage;
-		ev.xclient.window = clients[sel]->win;
-		ev.xclient.message_type = wmatom[WMProtocols];
-		ev.xclient.format = 32;
-		ev.xclient.data.l[0] = wmatom[WMDelete];
-		ev.xclient.data.l[1] = CurrentTime;
-		XSendEvent(dpy, clients[sel]->win, False, NoEventMask, &ev);
-		clients[sel]->closed = True;
-	} else {
-		XKillClient(dpy, clients[sel]->win);
+	/* only the selected tab is started now */
+	if (nclients) {
+		doinitspawn = False;
+		focus(selected);
 	}
 }
 
 void
 manage(Window w)
 {
-	updatenumlockmask();
-	{
-		int i, j, nextpos;
-		unsigned int modifiers[] = { 0, LockMask, numlockmask,
-		                             numlockmask | LockMask };
-		KeyCode code;
-		Client *c;
-		XEvent e;
-
-		XWithdrawWindow(dpy, w, 0);
-		XReparentWindow(dpy, w, win, 0, bh);
-		XSelectInput(dpy, w, PropertyChangeMask |
-		             StructureNotifyMask | EnterWindowMask);
-		XSync(dpy, False);
-
-		for (i = 0; i < LENGTH(keys); i++) {
-			if ((code = XKeysymToKeycode(dpy, keys[i].keysym))) {
-				for (j = 0; j < LENGTH(modifiers); j++) {
-					XGrabKey(dpy, code, keys[i].mod |
-					         modifiers[j], w, True,
-					         GrabModeAsync, GrabModeAsync);
-				}
-			}
-		}
-
-		for (i = 0; i < LENGTH(keyreleases); i++) {
-			if ((code = XKeysymToKeycode(dpy, keyreleases[i].keysym))) {
-				for (j = 0; j < LENGTH(modifiers); j++) {
-					XGrabKey(dpy, code, keyreleases[i].mod |
-					         modifiers[j], w, True,
-					         GrabModeAsync, GrabModeAsync);
-				}
+	int nextpos = -1, n, i, j;
+	unsigned long req = NextRequest(dpy);
+	Bool fromcmd = False, filled = False;
+	char *arg = NULL, *p, *end;
+	Client *c;
+	XEvent e;
+	pid_t pid;
+	xcb_get_property_cookie_t pidck[2], classck, titleck[2], iconck[2];
+	xcb_get_property_cookie_t protock;
+	xcb_get_property_reply_t *r;
+
+	XWithdrawWindow(dpy, w, 0);
+	XReparentWindow(dpy, w, win, 0, bh);
+	XSelectInput(dpy, w, PropertyChangeMask |
+	             StructureNotifyMask | EnterWindowMask);
+	grabkeys(w);
+
+	/* everything needed from the client in one round trip */
+	pidck[0] = getprop(w, wmatom[WMPid], XA_CARDINAL, 1);
+	pidck[1] = getprop(w, XA_WM_CLIENT_MACHINE, XCB_ATOM_ANY, 64);
+	if (freezedelay)
+		classck = getprop(w, XA_WM_CLASS, XA_STRING, 64);
+	titleck[0] = getprop(w, wmatom[WMName], XCB_ATOM_ANY, NAMELEN);
+	titleck[1] = getprop(w, XA_WM_NAME, XCB_ATOM_ANY, NAMELEN);
+	iconck[0] = getprop(w, wmatom[WMIcon], XA_CARDINAL, UINT32_MAX);
+	iconck[1] = getprop(w, XA_WM_HINTS, XA_WM_HINTS, 9);
+	protock = getprop(w, wmatom[WMProtocols], XA_ATOM, 32);
+	stats.roundtrips[curevent]++;
+
+	pid = wmpid(propreply(pidck[0]), propreply(pidck[1]));
+	for (i = 0; i < nspawned && pid && spawned[i].pid != pid; i++)
+		;
+	if (!pid) {
+		/* without a usable _NET_WM_PID, take it for the command only
+		 * if that is the single one pending; the pid stays unknown, so
+		 * a wrong guess is never signalled */
+		for (j = 0, i = nspawned; j < nspawned; j++) {
+			if (!spawned[j].fromcmd)
+				continue;
+			if (i < nspawned) {
+				i = nspawned;
+				break;
 			}
+			i = j;
 		}
+	}
+	if (i < nspawned) {
+		nextpos = findplaceholder(spawned[i].slot);
+		fromcmd = spawned[i].fromcmd;
+		arg = spawned[i].arg;
+		spawned[i].arg = NULL;
+		forgetspawn(i);
+	}
 
-		c = ecalloc(1, sizeof *c);
-		c->win = w;
-
-		nclients++;
-		clients = erealloc(clients, sizeof(Client *) * nclients);
-
+	if (nextpos > -1) {
+		/* the placeholder it was started for */
+		c = clients[nextpos];
+		filled = True;
+		c->spawning = False;
+		free(c->arg);
+		tab.win[nextpos] = w;
+		if ((unsigned int)nclients * 2 > wintabsz)
+			rehash(wintabsz ? wintabsz * 2 : 32);
+		else
+			indexclients(nextpos, nextpos + 1);
+	} else {
+		c = newclient();
+		n = nclients + 1;
 		if(npisrelative) {
 			nextpos = sel + newposition;
 		} else {
 			if (newposition < 0)
-				nextpos = nclients - newposition;
+				nextpos = n - newposition;
 			else
 				nextpos = newposition;
 		}
-		if (nextpos >= nclients)
-			nextpos = nclients - 1;
+		if (nextpos >= n)
+			nextpos = n - 1;
 		if (nextpos < 0)
 			nextpos = 0;
+		addtab(nextpos, c, w);
 
-		if (nclients > 1 && nextpos < nclients - 1)
-			memmove(&clients[nextpos + 1], &clients[nextpos],
-			        sizeof(Client *) * (nclients - nextpos - 1));
+		/* Adjust sel before focus does set it to lastsel. */
+		if (sel >= nextpos)
+			sel++;
+	}
+	c->fromcmd = fromcmd;
+	c->arg = arg;
+	if (pid) {
+		c->pid = pid;
+		c->pidfd = pidopen(pid);
+	}
+	c->idle = getms();
+	c->nofreeze = False;
+	c->protodel = isprotodel(propreply(protock));
+	if (freezedelay && (r = propreply(classck))) {
+		/* WM_CLASS is the instance and the class, NUL terminated */
+		p = xcb_get_property_value(r);
+		end = p + xcb_get_property_value_length(r);
+		for (; pid && p < end; p += strnlen(p, end - p) + 1) {
+			for (i = 0; i < LENGTH(nofreeze); i++) {
+				if (strnlen(p, end - p) == strlen(nofreeze[i]) &&
+				    !memcmp(p, nofreeze[i], strlen(nofreeze[i])))
+					c->nofreeze = True;
+			}
+		}
+		free(r);
+	}
+	updatetitlefrom(nextpos, titleck);
+	updateicon(nextpos, iconck);
+	if (freezedelay && !timers[TimerFreeze].when)
+		settimer(TimerFreeze, getms() + freezedelay * 1000LL);
 
-		clients[nextpos] = c;
-		updatetitle(nextpos);
+	XLowerWindow(dpy, w);
+	XMapWindow(dpy, w);
 
-		XLowerWindow(dpy, w);
-		XMapWindow(dpy, w);
+	e.xclient.window = w;
+	e.xclient.type = ClientMessage;
+	e.xclient.message_type = wmatom[XEmbed];
+	e.xclient.format = 32;
+	e.xclient.data.l[0] = CurrentTime;
+	e.xclient.data.l[1] = XEMBED_EMBEDDED_NOTIFY;
+	e.xclient.data.l[2] = 0;
+	e.xclient.data.l[3] = win;
+	e.xclient.data.l[4] = 0;
+	XSendEvent(dpy, root, False, NoEventMask, &e);
+	ctlevent("new %d 0x%lx\n", nextpos, w);
+
+	focus(nextfocus && !filled ? nextpos :
+	      sel < 0 ? 0 :
+	      sel);
+	nextfocus = foreground;
+	if (w != shown)
+		hidetab(getclient(w));
 
-		e.xclient.window = w;
-		e.xclient.type = ClientMessage;
-		e.xclient.message_type = wmatom[XEmbed];
-		e.xclient.format = 32;
-		e.xclient.data.l[0] = CurrentTime;
-		e.xclient.data.l[1] = XEMBED_EMBEDDED_NOTIFY;
-		e.xclient.data.l[2] = 0;
-		e.xclient.data.l[3] = win;
-		e.xclient.data.l[4] = 0;
-		XSendEvent(dpy, root, False, NoEventMask, &e);
+	stats.manages++;
+	stats.managereqs += NextRequest(dpy) - req;
+}
 
-		XSync(dpy, False);
+void
+mappingnotify(const XEvent *e)
+{
+	XMappingEvent ev = e->xmapping;
+	int c;
 
-		/* Adjust sel before focus does set it to lastsel. */
-		if (sel >= nextpos)
-			sel++;
-		focus(nextfocus ? nextpos :
-		      sel < 0 ? 0 :
-		      sel);
-		nextfocus = foreground;
+	XRefreshKeyboardMapping(&ev);
+	if (ev.request != MappingKeyboard && ev.request != MappingModifier)
+		return;
+
+	updatekeys();
+	for (c = 0; c < nclients; c++) {
+		if (tab.win[c] == None)
+			continue;
+		XUngrabKey(dpy, AnyKey, AnyModifier, tab.win[c]);
+		grabkeys(tab.win[c]);
 	}
 }
 
@@ -829,6 +1982,17 @@ maprequest(const XEvent *e)
 		manage(ev->window);
 }
 
+/* Errors caused by requests on w up to now are to be ignored. */
+void
+markdead(Window w)
+{
+	if (w == None)
+		return;
+	dead[ndead % LENGTH(dead)].win = w;
+	dead[ndead % LENGTH(dead)].serial = NextRequest(dpy);
+	ndead++;
+}
+
 void
 move(const Arg *arg)
 {
@@ -840,7 +2004,6 @@ void
 movetab(const Arg *arg)
 {
 	int c;
-	Client *new;
 
 	if (sel < 0)
 		return;
@@ -849,22 +2012,215 @@ movetab(const Arg *arg)
 	if (c < 0)
 		c += nclients;
 
-	if (c == sel)
+	placetab(sel, c);
+}
+
+Client *
+newclient(void)
+{
+	Client *c;
+	char *names, *name;
+	Gram *grams;
+	int i, n;
+
+	/* grow pool and title arena geometrically, slots are never moved */
+	if (!freeclients) {
+		n = 16 << (nchunks / 2);
+		c = ecalloc(n, sizeof(*c));
+		names = ecalloc(n, NAMELEN);
+		chunks = erealloc(chunks, (nchunks + 2) * sizeof(*chunks));
+		chunks[nchunks++] = c;
+		chunks[nchunks++] = names;
+		slots = erealloc(slots, (nslots + n) * sizeof(*slots));
+		for (i = n - 1; i >= 0; i--) {
+			c[i].name = &names[i * NAMELEN];
+			c[i].id = nslots + i;
+			slots[nslots + i] = &c[i];
+			freeclient(&c[i]);
+		}
+		nslots += n;
+	}
+
+	c = freeclients;
+	freeclients = c->next;
+	name = c->name;
+	grams = c->grams;
+	n = c->gramcap;
+	i = c->id;
+	memset(c, 0, sizeof(*c));
+	c->name = name;
+	c->grams = grams;
+	c->gramcap = n;
+	c->id = i;
+	c->name[0] = '\0';
+	c->w = -1;
+	c->pidfd = -1;
+
+	return c;
+}
+
+int
+nexttimeout(void)
+{
+	long long next = 0, now;
+	int i;
+
+	for (i = 0; i < TimerLast; i++) {
+		if (timers[i].when && (!next || timers[i].when < next))
+			next = timers[i].when;
+	}
+	if (!next)
+		return -1; /* nothing to do until something happens */
+	now = getms();
+
+	return next > now ? MIN(next - now, 1 << 30) : 0;
+}
+
+int
+pidopen(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+	return syscall(SYS_pidfd_open, pid, 0);
+#else
+	return -1; /* only our own children are noticed, by SIGCHLD */
+#endif
+}
+
+void
+placetab(int from, int to)
+{
+	Client *new;
+	Window w;
+	Bool urgent;
+
+	if (from == to)
 		return;
 
-	new = clients[sel];
-	if (sel < c)
-		memmove(&clients[sel], &clients[sel+1],
-		        sizeof(Client *) * (c - sel));
+	new = clients[from];
+	w = tab.win[from];
+	urgent = tab.urgent[from];
+	if (from < to)
+		shiftclients(from, from + 1, to - from);
 	else
-		memmove(&clients[c+1], &clients[c],
-		        sizeof(Client *) * (sel - c));
-	clients[c] = new;
-	sel = c;
+		shiftclients(to + 1, to, from - to);
+	clients[to] = new;
+	tab.win[to] = w;
+	tab.urgent[to] = urgent;
+	indexclients(MIN(from, to), MAX(from, to) + 1);
+
+	if (sel == from)
+		sel = to;
+	else if (from < sel && sel <= to)
+		sel--;
+	else if (to <= sel && sel < from)
+		sel++;
+	if (lastsel == from)
+		lastsel = to;
+	else if (from < lastsel && lastsel <= to)
+		lastsel--;
+	else if (to <= lastsel && lastsel < from)
+		lastsel++;
+	lay.stale = True;
+	ctlevent("move 0x%lx %d\n", w, to);
+	sessionchanged();
 
 	drawbar();
 }
 
+/* Waits up to timeout ms for anything but X and handles what came in. */
+void
+pollfds(int timeout)
+{
+	static struct pollfd *pfd;
+	static int pfdcap;
+	/* X, signals, memory pressure, control socket and its connections */
+	const int nfixed = 4 + LENGTH(ctl);
+	int c, i, n;
+
+	if (pfdcap < nclients + nfixed) {
+		pfdcap = nclients + nfixed;
+		pfd = erealloc(pfd, pfdcap * sizeof(*pfd));
+	}
+	pfd[0].fd = ConnectionNumber(dpy);
+	pfd[1].fd = sigpipe[0];
+	pfd[2].fd = psifd; /* poll() skips negative fds */
+	pfd[3].fd = ctlfd;
+	for (i = 0; i < LENGTH(ctl); i++)
+		pfd[4 + i].fd = ctl[i].fd;
+	for (n = nfixed, c = 0; c < nclients; c++) {
+		if (clients[c]->pidfd != -1)
+			pfd[n++].fd = clients[c]->pidfd;
+	}
+	for (i = 0; i < n; i++)
+		pfd[i].events = POLLIN;
+	pfd[2].events = POLLPRI;
+	for (i = 0; i < LENGTH(ctl); i++) {
+		/* no new commands until their answers went out */
+		if (ctl[i].outlen)
+			pfd[4 + i].events = POLLOUT;
+	}
+
+	if (poll(pfd, n, timeout) == -1) {
+		/* revents are left over from the last call */
+		if (errno == EINTR)
+			return;
+		die("%s: poll failed: %s\n", argv0, strerror(errno));
+	}
+	if (pfd[1].revents & POLLIN)
+		handlesignals();
+	for (i = nfixed; i < n; i++) {
+		if (!pfd[i].revents)
+			continue;
+		/* a process dying may have taken others along */
+		for (c = 0; c < nclients &&
+		     clients[c]->pidfd != pfd[i].fd; c++)
+			;
+		if (c < nclients)
+			processdied(clients[c]->pid);
+	}
+	for (i = 0; i < LENGTH(ctl); i++) {
+		if (pfd[4 + i].revents & POLLOUT)
+			ctlflush(&ctl[i]);
+		else if (pfd[4 + i].revents)
+			ctlread(&ctl[i]);
+	}
+	if (pfd[3].revents & POLLIN)
+		ctlaccept();
+	if (pfd[2].revents & POLLPRI)
+		discard();
+}
+
+void
+processdied(pid_t pid)
+{
+	int c, i;
+
+	for (i = 0; i < nspawned && spawned[i].pid != pid; i++)
+		;
+	if (i < nspawned)
+		forgetspawn(i);
+	/* tabs dying while we exit stay in the session, cleanup() releases
+	 * what is left of them */
+	if (!running)
+		return;
+
+	for (c = nclients - 1; c >= 0; c--) {
+		if (clients[c]->pid != pid)
+			continue;
+		/* windows can outlive their process if it shared its
+		 * connection, do not leave a dead tab behind */
+		XKillClient(dpy, tab.win[c]);
+		if (!respawn || !clients[c]->fromcmd || !cmd[0]) {
+			unmanage(c);
+			continue;
+		}
+		/* started again when it is focused */
+		unembed(c);
+		if (c == sel)
+			focus(c);
+	}
+}
+
 void
 propertynotify(const XEvent *e)
 {
@@ -886,10 +2242,10 @@ propertynotify(const XEvent *e)
 		}
 	} else if (ev->state == PropertyNewValue && ev->atom == XA_WM_HINTS &&
 	           (c = getclient(ev->window)) > -1 &&
-	           (wmh = XGetWMHints(dpy, clients[c]->win))) {
+	           (wmh = getwmhints(tab.win[c]))) {
 		if (wmh->flags & XUrgencyHint) {
 			XFree(wmh);
-			wmh = XGetWMHints(dpy, win);
+			wmh = getwmhints(win);
 			if (c != sel) {
 				if (urgentswitch && wmh &&
 				    !(wmh->flags & XUrgencyHint)) {
@@ -901,7 +2257,8 @@ propertynotify(const XEvent *e)
 				} else {
 					/* if no switch should be performed,
 					 * mark tab as urgent */
-					clients[c]->urgent = True;
+					tab.urgent[c] = True;
+					clients[c]->dirty = True;
 					drawbar();
 				}
 			}
@@ -913,14 +2270,66 @@ propertynotify(const XEvent *e)
 			}
 		}
 		XFree(wmh);
+		clients[c]->iconvalid = False;
 		if (c == sel)
 			xseticon();
 	} else if (ev->state != PropertyDelete && ev->atom == XA_WM_NAME &&
 	           (c = getclient(ev->window)) > -1) {
 		updatetitle(c);
-	} else if (ev->atom == wmatom[WMIcon] && (c = getclient(ev->window)) > -1 && c == sel) {
-		xseticon();
+	} else if (ev->atom == wmatom[WMIcon] && (c = getclient(ev->window)) > -1) {
+		clients[c]->iconvalid = False;
+		if (c == sel)
+			xseticon();
+	} else if (ev->atom == wmatom[WMProtocols] &&
+	           (c = getclient(ev->window)) > -1) {
+		stats.roundtrips[curevent]++;
+		clients[c]->protodel = isprotodel(propreply(getprop(ev->window,
+		                       wmatom[WMProtocols], XA_ATOM, 32)));
+	}
+}
+
+/* Errors are dropped, the reply is NULL then. */
+xcb_get_property_reply_t *
+propreply(xcb_get_property_cookie_t ck)
+{
+	return xcb_get_property_reply(xc, ck, NULL);
+}
+
+void
+rehash(unsigned int size)
+{
+	free(wintab);
+	wintab = ecalloc(size, sizeof(*wintab));
+	wintabsz = size;
+	indexclients(0, nclients);
+}
+
+/*
+ * Hands the client back to the root window, where the window manager takes
+ * it, or to another embedder. Mapped windows are mapped again by the
+ * reparent, which another tabbed takes as a MapRequest and manages; hidden
+ * ones are mapped here.
+ */
+void
+release(int c, Window to)
+{
+	Window w = tab.win[c];
+	Bool hidden = clients[c]->hidden;
+
+	sendxembed(c, XEMBED_FOCUS_OUT, 0, 0, 0);
+	sendxembed(c, XEMBED_WINDOW_DEACTIVATE, 0, 0, 0);
+	XSelectInput(dpy, w, NoEventMask);
+	XUngrabKey(dpy, AnyKey, AnyModifier, w);
+	if (hidden) {
+		stats.roundtrips[curevent]++;
+		clients[c]->stateck = getprop(w, wmatom[WMState], XA_ATOM, 64);
+		clients[c]->stateasked = True;
 	}
+	unsethidden(c);
+	unmanage(c);
+	XReparentWindow(dpy, w, to, 0, 0);
+	if (hidden && hidetabs > 1)
+		XMapWindow(dpy, w);
 }
 
 void
@@ -929,23 +2338,43 @@ resize(int c, int w, int h)
 	XConfigureEvent ce;
 	XWindowChanges wc;
 
+	if (tab.win[c] == None)
+		return; /* placeholder */
+
+	/* the client already has this geometry and was told so */
+	if (clients[c]->y == bh && clients[c]->w == w && clients[c]->h == h) {
+		stats.resizeskips++;
+		return;
+	}
+	clients[c]->y = bh;
+	clients[c]->w = w;
+	clients[c]->h = h;
+	stats.resizes++;
+
 	ce.x = 0;
 	ce.y = wc.y = bh;
 	ce.width = wc.width = w;
 	ce.height = wc.height = h;
 	ce.type = ConfigureNotify;
 	ce.display = dpy;
-	ce.event = clients[c]->win;
-	ce.window = clients[c]->win;
+	ce.event = tab.win[c];
+	ce.window = tab.win[c];
 	ce.above = None;
 	ce.override_redirect = False;
 	ce.border_width = 0;
 
-	XConfigureWindow(dpy, clients[c]->win, CWY | CWWidth | CWHeight, &wc);
-	XSendEvent(dpy, clients[c]->win, False, StructureNotifyMask,
+	XConfigureWindow(dpy, tab.win[c], CWY | CWWidth | CWHeight, &wc);
+	XSendEvent(dpy, tab.win[c], False, StructureNotifyMask,
 	           (XEvent *)&ce);
 }
 
+void
+resizesel(void)
+{
+	if (sel > -1)
+		resize(sel, ww, wh - bh);
+}
+
 void
 rotate(const Arg *arg)
 {
@@ -971,7 +2400,8 @@ rotate(const Arg *arg)
 void
 run(void)
 {
-	XEvent ev;
+	static XEvent ev[128];
+	int i, n;
 
 	/* main event loop */
 	XSync(dpy, False);
@@ -980,19 +2410,113 @@ run(void)
 		spawn(NULL);
 
 	while (running) {
-		XNextEvent(dpy, &ev);
-		if (handler[ev.type])
-			(handler[ev.type])(&ev); /* call handler */
+		/* sleep until X, a signal or the next timer wakes us up */
+		if (!XPending(dpy)) {
+			pollfds(nexttimeout());
+			updatestates();
+			runtimers();
+			XFlush(dpy);
+			continue;
+		}
+
+		/* take everything pending as one batch */
+		XNextEvent(dpy, &ev[0]);
+		for (n = 1; n < LENGTH(ev) && XPending(dpy); n++)
+			XNextEvent(dpy, &ev[n]);
+
+		deferdraw = True;
+		for (i = 0; i < n && running; i++) {
+			if (!handler[ev[i].type])
+				continue;
+			if (superseded(&ev[i], &ev[i + 1], n - i - 1)) {
+				stats.coalesced++;
+				continue;
+			}
+			curevent = ev[i].type;
+			stats.events[ev[i].type]++;
+			if (showstats)
+				evstart = getus();
+			(handler[ev[i].type])(&ev[i]); /* call handler */
+			curevent = 0;
+		}
+		deferdraw = False;
+		if (drawpending)
+			drawbar();
+		/* do not starve the rest under a flood of events */
+		pollfds(0);
+		updatestates();
+		runtimers();
+
+		/* handlers never sync, send their requests in one go */
+		XFlush(dpy);
 	}
 }
 
 void
-sendxembed(int c, long msg, long detail, long d1, long d2)
+runtimers(void)
 {
-	XEvent e = { 0 };
+	long long now = 0;
+	int i;
 
-	e.xclient.window = clients[c]->win;
-	e.xclient.type = ClientMessage;
+	for (i = 0; i < TimerLast; i++) {
+		if (!timers[i].when)
+			continue;
+		if (!now)
+			now = getms();
+		if (timers[i].when <= now) {
+			timers[i].when = 0;
+			timers[i].fn();
+		}
+	}
+}
+
+void
+savesession(void)
+{
+	const char *s;
+	char *tmp;
+	FILE *f;
+	int c, i;
+
+	timers[TimerSession].when = 0;
+	tmp = ecalloc(strlen(sessionfile) + 5, 1);
+	sprintf(tmp, "%s.tmp", sessionfile);
+	if (!(f = fopen(tmp, "w"))) {
+		fprintf(stderr, "%s: cannot write %s: %s\n", argv0, tmp,
+		        strerror(errno));
+		free(tmp);
+		return;
+	}
+
+	/* tabs we could not start again are not saved */
+	for (c = 0; c < nclients; c++) {
+		if (!clients[c]->fromcmd)
+			continue;
+		fputc(c == sel ? '*' : '-', f);
+		for (i = 0; i < 2; i++) {
+			fputc('\t', f);
+			s = i ? clients[c]->arg : clients[c]->name;
+			for (; s && *s; s++)
+				fputc((unsigned char)*s < ' ' ? ' ' : *s, f);
+		}
+		fputc('\n', f);
+	}
+
+	if (fclose(f) == EOF || rename(tmp, sessionfile) == -1) {
+		fprintf(stderr, "%s: cannot write %s: %s\n", argv0,
+		        sessionfile, strerror(errno));
+		unlink(tmp);
+	}
+	free(tmp);
+}
+
+void
+sendxembed(int c, long msg, long detail, long d1, long d2)
+{
+	XEvent e = { 0 };
+
+	e.xclient.window = tab.win[c];
+	e.xclient.type = ClientMessage;
 	e.xclient.message_type = wmatom[XEmbed];
 	e.xclient.format = 32;
 	e.xclient.data.l[0] = CurrentTime;
@@ -1000,7 +2524,15 @@ sendxembed(int c, long msg, long detail, long d1, long d2)
 	e.xclient.data.l[2] = detail;
 	e.xclient.data.l[3] = d1;
 	e.xclient.data.l[4] = d2;
-	XSendEvent(dpy, clients[c]->win, False, NoEventMask, &e);
+	XSendEvent(dpy, tab.win[c], False, NoEventMask, &e);
+}
+
+/* Changes are written out together, at most once a second. */
+void
+sessionchanged(void)
+{
+	if (sessionfile && !timers[TimerSession].when)
+		settimer(TimerSession, getms() + 1000);
 }
 
 void
@@ -1018,33 +2550,68 @@ setcmd(int argc, char *argv[], int replace)
 	cmd[cmd_append_pos] = cmd[cmd_append_pos + 1] = NULL;
 }
 
+void
+settimer(int t, long long when)
+{
+	timers[t].when = when;
+}
+
 void
 setup(void)
 {
-	int bitm, tx, ty, tw, th, dh, dw, isfixed;
+	int bitm, tx, ty, tw, th, dh, dw, isfixed, i;
+	struct sigaction sa;
+	char buf[32];
 	XWMHints *wmh;
 	XClassHint class_hint;
 	XSizeHints *size_hint;
+	static char *atomnames[WMLast] = {
+		[WMProtocols] = "WM_PROTOCOLS",
+		[WMDelete] = "WM_DELETE_WINDOW",
+		[WMName] = "_NET_WM_NAME",
+		[WMState] = "_NET_WM_STATE",
+		[WMFullscreen] = "_NET_WM_STATE_FULLSCREEN",
+		[XEmbed] = "_XEMBED",
+		[WMSelectTab] = "_TABBED_SELECT_TAB",
+		[WMIcon] = "_NET_WM_ICON",
+		[WMPid] = "_NET_WM_PID",
+		[WMHidden] = "_NET_WM_STATE_HIDDEN",
+	};
+
+	/* signals are handled from the event loop */
+	if (pipe(sigpipe) == -1)
+		die("%s: cannot create signal pipe\n", argv0);
+	for (i = 0; i < 2; i++) {
+		fcntl(sigpipe[i], F_SETFD, FD_CLOEXEC);
+		fcntl(sigpipe[i], F_SETFL, O_NONBLOCK);
+	}
+	sa.sa_handler = sighandler;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	if (sigaction(SIGCHLD, &sa, NULL) == -1 ||
+	    sigaction(SIGTERM, &sa, NULL) == -1)
+		die("%s: cannot install signal handlers\n", argv0);
 
 	/* clean up any zombies immediately */
-	sigchld(0);
+	sighandler(SIGCHLD);
+
+	/* keep the X connection out of spawned clients */
+	if (fcntl(ConnectionNumber(dpy), F_SETFD, FD_CLOEXEC) == -1)
+		die("%s: cannot set close-on-exec on the X connection\n", argv0);
 
 	/* init screen */
 	screen = DefaultScreen(dpy);
+	xc = XGetXCBConnection(dpy);
 	root = RootWindow(dpy, screen);
 	initfont(font);
 	vbh = dc.h = dc.font.height + 2;
+	lay.bw = TEXTW(before);
+	lay.aw = TEXTW(after);
+	updatekeys();
 
-	/* init atoms */
-	wmatom[WMDelete] = XInternAtom(dpy, "WM_DELETE_WINDOW", False);
-	wmatom[WMFullscreen] = XInternAtom(dpy, "_NET_WM_STATE_FULLSCREEN",
-	                                   False);
-	wmatom[WMName] = XInternAtom(dpy, "_NET_WM_NAME", False);
-	wmatom[WMProtocols] = XInternAtom(dpy, "WM_PROTOCOLS", False);
-	wmatom[WMSelectTab] = XInternAtom(dpy, "_TABBED_SELECT_TAB", False);
-	wmatom[WMState] = XInternAtom(dpy, "_NET_WM_STATE", False);
-	wmatom[XEmbed] = XInternAtom(dpy, "_XEMBED", False);
-	wmatom[WMIcon] = XInternAtom(dpy, "_NET_WM_ICON", False);
+	/* init atoms, in one round trip */
+	XInternAtoms(dpy, atomnames, WMLast, False, wmatom);
+	stats.roundtrips[curevent]++;
 
 	/* init appearance */
 	wx = 0;
@@ -1086,12 +2653,21 @@ setup(void)
 	dc.sel[ColFG] = getcolor(selfgcolor);
 	dc.urg[ColBG] = getcolor(urgbgcolor);
 	dc.urg[ColFG] = getcolor(urgfgcolor);
-	dc.drawable = XCreatePixmap(dpy, root, ww, wh,
+	dc.drawablew = ww;
+	dc.drawable = XCreatePixmap(dpy, root, dc.drawablew, vbh,
 	                            DefaultDepth(dpy, screen));
+	stats.pixmaps++;
+	dc.xftdraw = XftDrawCreate(dpy, dc.drawable, DefaultVisual(dpy, screen),
+	                           DefaultColormap(dpy, screen));
+	stats.xftdraws++;
 	dc.gc = XCreateGC(dpy, root, 0, 0);
 
 	win = XCreateSimpleWindow(dpy, root, wx, wy, ww, wh, 0,
 	                          dc.norm[ColFG].pixel, dc.norm[ColBG].pixel);
+	blank = XCreateSimpleWindow(dpy, win, 0, bh, DisplayWidth(dpy, screen),
+	                            DisplayHeight(dpy, screen), 0, 0,
+	                            dc.norm[ColBG].pixel);
+	XMapWindow(dpy, blank);
 	XMapRaised(dpy, win);
 	XSelectInput(dpy, win, SubstructureNotifyMask | FocusChangeMask |
 	             ButtonPressMask | ExposureMask | KeyPressMask |
@@ -1120,6 +2696,27 @@ setup(void)
 	XFree(wmh);
 
 	XSetWMProtocols(dpy, win, &wmatom[WMDelete], 1);
+	for (i = 0; i < LENGTH(ctl); i++)
+		ctl[i].fd = -1;
+	if (controlsocket)
+		ctlsetup();
+
+	/* memory pressure, see Documentation/accounting/psi.rst */
+	if (discardstall > 0) {
+		/* unprivileged triggers need a multiple of two seconds */
+		snprintf(buf, sizeof(buf), "some %d 2000000", discardstall);
+		if ((psifd = open("/proc/pressure/memory",
+		                  O_RDWR | O_NONBLOCK | O_CLOEXEC)) == -1 ||
+		    write(psifd, buf, strlen(buf) + 1) == -1) {
+			fprintf(stderr, "%s: cannot watch memory pressure: %s\n",
+			        argv0, strerror(errno));
+			if (psifd != -1)
+				close(psifd);
+			psifd = -1;
+		}
+	}
+	if (discardrss > 0)
+		settimer(TimerDiscard, getms() + 5000);
 
 	snprintf(winid, sizeof(winid), "%lu", win);
 	setenv("XEMBED", winid, 1);
@@ -1139,50 +2736,464 @@ setup(void)
 	focus(-1);
 }
 
+void
+shiftclients(int to, int from, int n)
+{
+	if (n <= 0)
+		return;
+
+	memmove(&clients[to], &clients[from], n * sizeof(*clients));
+	memmove(&tab.win[to], &tab.win[from], n * sizeof(*tab.win));
+	memmove(&tab.x[to], &tab.x[from], n * sizeof(*tab.x));
+	memmove(&tab.urgent[to], &tab.urgent[from], n * sizeof(*tab.urgent));
+}
+
 void
 showbar(const Arg *arg)
 {
+	/* the switcher keeps the bar, it is hidden when the switcher ends */
+	if (sw.active) {
+		sw.barvisibility = arg->i;
+		return;
+	}
 	barvisibility = arg->i;
 	drawbar();
 }
 
 void
-sigchld(int unused)
+showtab(int c)
 {
-	if (signal(SIGCHLD, sigchld) == SIG_ERR)
-		die("%s: cannot install SIGCHLD handler", argv0);
+	if (!clients[c]->hidden)
+		return;
+	clients[c]->hidden = False;
+	if (hidetabs > 1)
+		XMapWindow(dpy, tab.win[c]);
+	/* answered by updatestates(), one round trip for the whole batch */
+	clients[c]->stateck = getprop(tab.win[c], wmatom[WMState], XA_ATOM, 64);
+	clients[c]->stateasked = True;
+	statesasked = True;
+}
 
-	while (0 < waitpid(-1, NULL, WNOHANG));
+/* Only tells the event loop, see handlesignals(). */
+void
+sighandler(int sig)
+{
+	int olderrno = errno;
+	unsigned char c = sig;
+
+	/* a full pipe wakes the loop up all the same */
+	while (write(sigpipe[1], &c, 1) == -1 && errno == EINTR)
+		;
+	errno = olderrno;
 }
 
+/* posix_spawn does not copy our address space like fork does and, where it
+ * is implemented with vfork semantics, only returns once the child exec'd. */
 void
 spawn(const Arg *arg)
 {
-	if (fork() == 0) {
-		if(dpy)
-			close(ConnectionNumber(dpy));
+	static posix_spawnattr_t attr;
+	static Bool attrinit;
+	extern char **environ;
+	char **argv;
+	long long us;
+	pid_t pid;
+	int err;
+
+	if (!attrinit) {
+		posix_spawnattr_init(&attr);
+#ifdef POSIX_SPAWN_SETSID
+		posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID);
+#else
+		/* at least keep terminal signals away from the clients */
+		posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+		posix_spawnattr_setpgroup(&attr, 0);
+#endif
+		attrinit = True;
+	}
 
-		setsid();
-		if (arg && arg->v) {
-			execvp(((char **)arg->v)[0], (char **)arg->v);
-			fprintf(stderr, "%s: execvp %s", argv0,
-			        ((char **)arg->v)[0]);
-		} else {
-			cmd[cmd_append_pos] = NULL;
-			execvp(cmd[0], cmd);
-			fprintf(stderr, "%s: execvp %s", argv0, cmd[0]);
+	if (arg && arg->v) {
+		argv = (char **)arg->v;
+	} else {
+		cmd[cmd_append_pos] = NULL;
+		argv = cmd;
+	}
+
+	if ((err = posix_spawnp(&pid, argv[0], NULL, &attr, argv, environ))) {
+		fprintf(stderr, "%s: execvp %s failed: %s\n", argv0, argv[0],
+		        strerror(err));
+		return;
+	}
+
+	/* remember it until its window shows up, forget the oldest one */
+	if (nspawned == LENGTH(spawned))
+		forgetspawn(0);
+	spawned[nspawned].pid = pid;
+	spawned[nspawned].slot = spawnslot;
+	spawned[nspawned].fromcmd = argv == cmd;
+	spawned[nspawned].arg = argv == cmd && cmd[cmd_append_pos] ?
+	                        strcpy(ecalloc(strlen(cmd[cmd_append_pos]) + 1,
+	                               1), cmd[cmd_append_pos]) : NULL;
+	nspawned++;
+	if (spawnslot > -1)
+		slots[spawnslot]->spawning = True;
+
+	if (showstats && curevent) {
+		us = getus() - evstart;
+		stats.spawns++;
+		stats.spawnus += us;
+		stats.spawnmax = MAX(stats.spawnmax, us);
+	}
+}
+
+void
+spawntab(int c)
+{
+	Arg arg = { .v = cmd };
+
+	if (!cmd[0] || clients[c]->spawning || !running)
+		return;
+	cmd[cmd_append_pos] = clients[c]->arg;
+	spawnslot = clients[c]->id;
+	spawn(&arg);
+	spawnslot = -1;
+	cmd[cmd_append_pos] = NULL;
+}
+
+/* Events whose handlers only pick up the latest state can be skipped if a
+ * later event of the same batch does the same. */
+Bool
+superseded(const XEvent *e, const XEvent *later, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (later[i].type != e->type)
+			continue;
+
+		switch (e->type) {
+		case ConfigureNotify:
+			if (later[i].xconfigure.window == e->xconfigure.window)
+				return True;
+			break;
+		case Expose:
+			if (later[i].xexpose.window == e->xexpose.window)
+				return True;
+			break;
+		case PropertyNotify:
+			if (e->xproperty.state == PropertyNewValue &&
+			    (e->xproperty.atom == XA_WM_NAME ||
+			    e->xproperty.atom == wmatom[WMName]) &&
+			    later[i].xproperty.window == e->xproperty.window &&
+			    later[i].xproperty.atom == e->xproperty.atom &&
+			    later[i].xproperty.state == PropertyNewValue)
+				return True;
+			break;
+		}
+	}
+
+	return False;
+}
+
+void
+switcher(const Arg *arg)
+{
+	if (sw.active || nclients == 0)
+		return;
+	stats.roundtrips[curevent]++;
+	if (XGrabKeyboard(dpy, win, True, GrabModeAsync, GrabModeAsync,
+	                  CurrentTime) != GrabSuccess)
+		return;
+
+	sw.active = True;
+	sw.barvisibility = barvisibility;
+	barvisibility = True;
+	sw.query[0] = '\0';
+	sw.len = 0;
+	sw.curid = sel > -1 ? clients[sel]->id : -1;
+	drawbar();
+}
+
+/* The query on the left, the matches laid out like tabs next to it. */
+void
+switcherdraw(void)
+{
+	XftColor *col;
+	int c, i, cc, fc, w;
+
+	switcherfilter();
+
+	dc.x = 0;
+	dc.w = w = MIN(tabwidth, ww);
+	drawtext(sw.query, dc.norm, NULL);
+
+	cc = MAX(1, (ww - w) / tabwidth);
+	fc = sw.cur - sw.cur % cc;
+	for (i = fc; i < fc + cc; i++) {
+		dc.x += dc.w;
+		dc.w = (ww - w) / cc;
+		if (i >= sw.nmatch) {
+			drawtext(NULL, dc.norm, NULL);
+			continue;
 		}
-		perror(" failed");
-		exit(0);
+		c = sw.match[i];
+		if (i == sw.cur)
+			col = dc.sel;
+		else
+			col = tab.urgent[c] ? dc.urg : dc.norm;
+		drawtext(clients[c]->name, col, NULL);
 	}
+	dc.x += dc.w;
+	dc.w = ww - dc.x;
+	drawtext(NULL, dc.norm, NULL);
+
+	XCopyArea(dpy, dc.drawable, win, dc.gc, 0, 0, ww, bh, 0, 0);
+	redrawall = True;
+}
+
+void
+switcherend(int c)
+{
+	XUngrabKeyboard(dpy, CurrentTime);
+	sw.active = False;
+	barvisibility = sw.barvisibility;
+	redrawall = True;
+	if (c > -1)
+		focus(c);
+	drawbar();
+}
+
+/*
+ * Candidates come from the shortest posting list of the query's trigrams,
+ * shorter queries scan all titles. Both are verified by substring match.
+ */
+void
+switcherfilter(void)
+{
+	Trigram *t, *best = NULL;
+	int c, i, key, n = 0;
+	const unsigned char *q = (unsigned char *)sw.query;
+
+	if (sw.cap < MAX(nclients, nslots)) {
+		sw.cap = MAX(nclients, nslots);
+		sw.match = erealloc(sw.match, sw.cap * sizeof(*sw.match));
+		sw.pos = erealloc(sw.pos, sw.cap * sizeof(*sw.pos));
+	}
+
+	for (i = 0; i + 2 < sw.len; i++) {
+		key = q[i] << 16 | q[i + 1] << 8 | q[i + 2];
+		if (!(t = trigram(key, False)) || !t->n) {
+			sw.nmatch = sw.cur = 0;
+			return;
+		}
+		if (!best || t->n < best->n)
+			best = t;
+	}
+
+	if (best) {
+		for (c = 0; c < nclients; c++)
+			sw.pos[clients[c]->id] = c;
+		for (i = 0; i < best->n; i++) {
+			if (titlematch(slots[best->posts[i].id]->name,
+			    sw.query))
+				sw.match[n++] = sw.pos[best->posts[i].id];
+		}
+		qsort(sw.match, n, sizeof(*sw.match), cmpint);
+	} else {
+		for (c = 0; c < nclients; c++) {
+			if (titlematch(clients[c]->name, sw.query))
+				sw.match[n++] = c;
+		}
+	}
+	sw.nmatch = n;
+
+	for (sw.cur = 0; sw.cur < n; sw.cur++) {
+		if (clients[sw.match[sw.cur]]->id == sw.curid)
+			break;
+	}
+	if (sw.cur == n)
+		sw.cur = 0;
+}
+
+void
+switcherkey(const XKeyEvent *ev)
+{
+	char buf[32];
+	KeySym keysym;
+	int i, n;
+
+	n = XLookupString((XKeyEvent *)ev, buf, sizeof(buf), &keysym, NULL);
+	switch (keysym) {
+	case XK_Escape:
+		switcherend(-1);
+		return;
+	case XK_Return:
+	case XK_KP_Enter:
+		switcherend(sw.nmatch ? sw.match[sw.cur] : -1);
+		return;
+	case XK_Tab:
+	case XK_Down:
+	case XK_Right:
+	case XK_ISO_Left_Tab:
+	case XK_Up:
+	case XK_Left:
+		if (!sw.nmatch)
+			return;
+		i = keysym == XK_Tab || keysym == XK_Down ||
+		    keysym == XK_Right ? 1 : sw.nmatch - 1;
+		sw.cur = (sw.cur + i) % sw.nmatch;
+		sw.curid = clients[sw.match[sw.cur]]->id;
+		break;
+	case XK_BackSpace:
+		if (!sw.len)
+			return;
+		sw.query[--sw.len] = '\0';
+		break;
+	default:
+		/* titles are UTF-8, XLookupString gives Latin-1 */
+		for (i = 0; i < n && sw.len < sizeof(sw.query) - 1; i++) {
+			if (buf[i] >= ' ' && buf[i] < 127)
+				sw.query[sw.len++] = LOWER(buf[i]);
+		}
+		sw.query[sw.len] = '\0';
+		if (!n)
+			return;
+	}
+	drawbar();
+}
+
+int
+tabat(int x)
+{
+	int lo, hi, mid;
+
+	/* first visible tab whose right border lies beyond x */
+	lo = lay.fc;
+	hi = lay.fc + lay.cc;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (tab.x[mid] > x)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return lo < lay.fc + lay.cc ? lo : -1;
+}
+
+void
+textfit(const char *text, int w, Fit *fit)
+{
+	int off[257], px[257]; /* codepoint offsets and prefix widths */
+	int n, l, lo, hi, mid, olen, len, tw;
+	FcChar32 ucs;
+
+	olen = strlen(text);
+	len = MIN(olen, LENGTH(off) - 1);
+	off[0] = px[0] = 0;
+	for (n = 0; off[n] < len && (l = FcUtf8ToUcs4((FcChar8 *)&text[off[n]],
+	     &ucs, len - off[n])) > 0; n++) {
+		off[n + 1] = off[n] + l;
+		px[n + 1] = px[n] + glyphw(ucs);
+	}
+
+	fit->w = w;
+	if (off[n] == olen && px[n] <= w) {
+		fit->len = olen;
+		fit->trim = False;
+		return;
+	}
+
+	/* longest codepoint prefix which still leaves room for titletrim */
+	tw = textnw(titletrim, strlen(titletrim));
+	for (lo = 0, hi = n; lo < hi;) {
+		mid = (lo + hi + 1) / 2;
+		if (px[mid] + tw <= w)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	fit->trim = px[lo] + tw <= w;
+	fit->len = fit->trim ? off[lo] : 0;
 }
 
 int
 textnw(const char *text, unsigned int len)
 {
-	XGlyphInfo ext;
-	XftTextExtentsUtf8(dpy, dc.font.xfont, (XftChar8 *) text, len, &ext);
-	return ext.xOff;
+	FcChar32 ucs;
+	int l, w = 0;
+
+	for (; len > 0 && (l = FcUtf8ToUcs4((FcChar8 *)text, &ucs, len)) > 0;
+	     text += l, len -= l)
+		w += glyphw(ucs);
+
+	return w;
+}
+
+/* Decodes a text property into text and frees the reply. */
+Bool
+textprop(xcb_get_property_reply_t *r, char *text, unsigned int size)
+{
+	char **list = NULL;
+	int n;
+	XTextProperty name;
+
+	text[0] = '\0';
+	if (!r || r->format != 8 || !(n = xcb_get_property_value_length(r))) {
+		free(r);
+		return False;
+	}
+
+	/* Xlib expects it NUL terminated */
+	name.value = ecalloc(n + 1, 1);
+	memcpy(name.value, xcb_get_property_value(r), n);
+	name.encoding = r->type;
+	name.format = 8;
+	name.nitems = n;
+	free(r);
+	if (name.encoding == XA_STRING) {
+		strncpy(text, (char *)name.value, size - 1);
+	} else if (XmbTextPropertyToTextList(dpy, &name, &list, &n) >= Success
+	           && n > 0 && *list) {
+		strncpy(text, *list, size - 1);
+		XFreeStringList(list);
+	}
+	text[size - 1] = '\0';
+	free(name.value);
+
+	return True;
+}
+
+void
+thaw(int c)
+{
+	int o;
+
+	if (!clients[c]->frozen)
+		return;
+	kill(clients[c]->pid, SIGCONT);
+	for (o = 0; o < nclients; o++) {
+		if (clients[o]->pid == clients[c]->pid)
+			clients[o]->frozen = False;
+	}
+}
+
+/* Whether title contains q, which is lowercased, ignoring ASCII case. */
+Bool
+titlematch(const char *title, const char *q)
+{
+	const char *s, *p;
+
+	if (!*q)
+		return True;
+	for (; *title; title++) {
+		for (s = title, p = q; *p && LOWER(*s) == *p; s++, p++)
+			;
+		if (!*p)
+			return True;
+	}
+
+	return False;
 }
 
 void
@@ -1191,35 +3202,121 @@ toggle(const Arg *arg)
     *(Bool*) arg->v = !*(Bool*) arg->v;
 }
 
+Trigram *
+trigram(int key, Bool create)
+{
+	Trigram *old = trigrams;
+	unsigned int i, j, oldsz = trigramsz;
+
+	/* keep the table at most half full */
+	if (create && (ntrigrams + 1) * 2 > trigramsz) {
+		trigramsz = trigramsz ? trigramsz * 2 : 1024;
+		trigrams = ecalloc(trigramsz, sizeof(*trigrams));
+		for (i = 0; i < oldsz; i++) {
+			if (!old[i].key)
+				continue;
+			for (j = old[i].key * 2654435769U & (trigramsz - 1);
+			     trigrams[j].key; j = (j + 1) & (trigramsz - 1))
+				;
+			trigrams[j] = old[i];
+		}
+		free(old);
+	}
+	if (!trigramsz)
+		return NULL;
+
+	for (i = key * 2654435769U & (trigramsz - 1); trigrams[i].key;
+	     i = (i + 1) & (trigramsz - 1)) {
+		if (trigrams[i].key == key)
+			return &trigrams[i];
+	}
+	if (!create)
+		return NULL;
+	trigrams[i].key = key;
+	ntrigrams++;
+
+	return &trigrams[i];
+}
+
+/* Turns the tab into a placeholder that keeps its title and command. */
+void
+unembed(int c)
+{
+	Client *cl = clients[c];
+
+	ctlevent("close 0x%lx\n", tab.win[c]);
+	unindexclient(tab.win[c]);
+	markdead(tab.win[c]);
+	tab.win[c] = None;
+	tab.urgent[c] = False;
+	if (cl->pid && cl->pidfd != -1)
+		close(cl->pidfd);
+	cl->pid = 0;
+	cl->pidfd = -1;
+	free(cl->icon);
+	cl->icon = NULL;
+	cl->iconvalid = False;
+	cl->closed = False;
+	cl->hidden = False;
+	cl->unmaps = 0;
+	if (cl->stateasked)
+		xcb_discard_reply(xc, cl->stateck.sequence);
+	cl->stateasked = False;
+	cl->w = -1;
+	cl->dirty = True;
+	drawbar();
+}
+
+void
+unindexclient(Window w)
+{
+	unsigned int i, j, k, mask;
+
+	if (!wintabsz || w == None)
+		return;
+
+	mask = wintabsz - 1;
+	for (i = winhash(w) & mask; wintab[i].win != w; i = (i + 1) & mask) {
+		if (wintab[i].win == None)
+			return;
+	}
+
+	/* backward shift deletion, no tombstones needed */
+	for (j = i;;) {
+		wintab[i].win = None;
+		do {
+			j = (j + 1) & mask;
+			if (wintab[j].win == None)
+				return;
+			k = winhash(wintab[j].win) & mask;
+		} while (i <= j ? (i < k && k <= j) : (i < k || k <= j));
+		wintab[i] = wintab[j];
+		i = j;
+	}
+}
+
 void
 unmanage(int c)
 {
 	if (c < 0 || c >= nclients) {
 		drawbar();
-		XSync(dpy, False);
 		return;
 	}
 
 	if (!nclients)
 		return;
 
-	if (c == 0) {
-		/* First client. */
-		nclients--;
-		free(clients[0]);
-		memmove(&clients[0], &clients[1], sizeof(Client *) * nclients);
-	} else if (c == nclients - 1) {
-		/* Last client. */
-		nclients--;
-		free(clients[c]);
-		clients = erealloc(clients, sizeof(Client *) * nclients);
-	} else {
-		/* Somewhere inbetween. */
-		free(clients[c]);
-		memmove(&clients[c], &clients[c+1],
-		        sizeof(Client *) * (nclients - (c + 1)));
-		nclients--;
-	}
+	ctlevent("close 0x%lx\n", tab.win[c]);
+	thaw(c);
+	unindexclient(tab.win[c]);
+	indextitle(clients[c], False);
+	markdead(tab.win[c]);
+	freeclient(clients[c]);
+	shiftclients(c, c + 1, nclients - (c + 1));
+	nclients--;
+	indexclients(c, nclients);
+	lay.stale = True;
+	sessionchanged();
 
 	if (nclients <= 0) {
 		lastsel = sel = -1;
@@ -1247,7 +3344,6 @@ unmanage(int c)
 	}
 
 	drawbar();
-	XSync(dpy, False);
 }
 
 void
@@ -1256,8 +3352,243 @@ unmapnotify(const XEvent *e)
 	const XUnmapEvent *ev = &e->xunmap;
 	int c;
 
-	if ((c = getclient(ev->window)) > -1)
-		unmanage(c);
+	/* each unmap is also reported to the client window itself */
+	if (ev->event != win || (c = getclient(ev->window)) < 0)
+		return;
+	if (clients[c]->unmaps > 0) {
+		clients[c]->unmaps--; /* hidetab() */
+		return;
+	}
+	unmanage(c);
+}
+
+/*
+ * Removes what hidetab() added to _NET_WM_STATE, keeping the other states,
+ * once showtab() got it back. Waits only if the reply is not in yet.
+ */
+void
+unsethidden(int c)
+{
+	Client *cl = clients[c];
+	xcb_get_property_reply_t *r;
+	uint32_t *v;
+	Atom states[64];
+	int i, j;
+
+	if (!cl->stateasked)
+		return;
+	cl->stateasked = False;
+	if (!(r = propreply(cl->stateck)))
+		return;
+	if (r->type == XA_ATOM && r->format == 32) {
+		v = xcb_get_property_value(r);
+		for (i = j = 0; i < r->value_len && i < LENGTH(states); i++) {
+			if (v[i] != wmatom[WMHidden])
+				states[j++] = v[i];
+		}
+		if (j < i)
+			XChangeProperty(dpy, tab.win[c], wmatom[WMState],
+			                XA_ATOM, 32, PropModeReplace,
+			                (unsigned char *)states, j);
+	}
+	free(r);
+}
+
+/* Drops an emptied trigram, by backward shift deletion like unindexclient(). */
+void
+untrigram(int key)
+{
+	unsigned int i, j, k, mask = trigramsz - 1;
+
+	for (i = key * 2654435769U & mask; trigrams[i].key != key;
+	     i = (i + 1) & mask) {
+		if (!trigrams[i].key)
+			return;
+	}
+	free(trigrams[i].posts);
+	ntrigrams--;
+
+	for (j = i;;) {
+		memset(&trigrams[i], 0, sizeof(*trigrams));
+		do {
+			j = (j + 1) & mask;
+			if (!trigrams[j].key)
+				return;
+			k = trigrams[j].key * 2654435769U & mask;
+		} while (i <= j ? (i < k && k <= j) : (i < k || k <= j));
+		trigrams[i] = trigrams[j];
+		i = j;
+	}
+}
+
+/* Takes the icon from _NET_WM_ICON or WM_HINTS, requested as ck. */
+void
+updateicon(int c, xcb_get_property_cookie_t ck[2])
+{
+	Client *cl = clients[c];
+	xcb_get_property_reply_t *r;
+	XWMHints *wmh;
+	uint32_t *v;
+	unsigned long i, n = 0;
+
+	free(cl->icon);
+	cl->icon = NULL;
+	cl->nicon = 0;
+	cl->iconpixmap = cl->iconmask = None;
+
+	r = propreply(ck[0]);
+	if (r && r->type == XA_CARDINAL && r->format == 32)
+		n = r->value_len;
+	if (n) {
+		xcb_discard_reply(xc, ck[1].sequence);
+		/* longs, as XChangeProperty() takes them */
+		v = xcb_get_property_value(r);
+		cl->icon = ecalloc(n, sizeof(*cl->icon));
+		for (i = 0; i < n; i++)
+			cl->icon[i] = v[i];
+		cl->nicon = n;
+		cl->iconhash = hashbytes(cl->icon, n * sizeof(*cl->icon),
+		                         0xcbf29ce484222325UL);
+	} else {
+		if ((wmh = wmhints(propreply(ck[1]))) &&
+		    wmh->flags & IconPixmapHint) {
+			cl->iconpixmap = wmh->icon_pixmap;
+			if (wmh->flags & IconMaskHint)
+				cl->iconmask = wmh->icon_mask;
+		}
+		if (wmh)
+			XFree(wmh);
+		cl->iconhash = hashbytes(&cl->iconpixmap,
+		                         sizeof(cl->iconpixmap), 1);
+		cl->iconhash = hashbytes(&cl->iconmask,
+		                         sizeof(cl->iconmask), cl->iconhash);
+	}
+	free(r);
+	cl->iconhash |= 1; /* 0 means unknown */
+	cl->iconvalid = True;
+}
+
+void
+updatekeys(void)
+{
+	static const struct {
+		const Key *keys;
+		int n;
+	} sets[] = {
+		{ keys, LENGTH(keys) },
+		{ keyreleases, LENGTH(keyreleases) },
+	};
+	unsigned int modifiers[4], mod;
+	int i, j, k, s, n, min, max, nbindings = 0;
+	KeyCode code;
+	KeySym keysym;
+
+	updatenumlockmask();
+	modifiers[0] = 0;
+	modifiers[1] = LockMask;
+	modifiers[2] = numlockmask;
+	modifiers[3] = numlockmask | LockMask;
+
+	for (s = n = 0; s < LENGTH(sets); s++)
+		n += sets[s].n * LENGTH(modifiers);
+	grabs = erealloc(grabs, n * sizeof(*grabs));
+
+	for (ngrabs = s = 0; s < LENGTH(sets); s++) {
+		for (i = 0; i < sets[s].n; i++) {
+			if (!(code = XKeysymToKeycode(dpy, sets[s].keys[i].keysym)))
+				continue;
+			for (j = 0; j < LENGTH(modifiers); j++) {
+				mod = sets[s].keys[i].mod | modifiers[j];
+				for (k = 0; k < ngrabs; k++) {
+					if (grabs[k].code == code &&
+					    grabs[k].mod == mod)
+						break;
+				}
+				if (k == ngrabs) {
+					grabs[ngrabs].code = code;
+					grabs[ngrabs++].mod = mod;
+				}
+			}
+		}
+	}
+
+	/* dispatch table, keypress() and keyrelease() index it by keycode */
+	XDisplayKeycodes(dpy, &min, &max);
+	for (s = n = 0; s < LENGTH(sets); s++) {
+		for (k = 0; k < LENGTH(keymap[s]) - 1; k++) {
+			keymap[s][k] = nbindings;
+			if (k < min || k > max)
+				continue;
+			keysym = XkbKeycodeToKeysym(dpy, k, 0, 0);
+			for (i = 0; i < sets[s].n; i++) {
+				if (sets[s].keys[i].keysym != keysym ||
+				    !sets[s].keys[i].func)
+					continue;
+				if (nbindings == n) {
+					n = n ? n * 2 : 32;
+					bindings = erealloc(bindings,
+					                    n * sizeof(*bindings));
+				}
+				bindings[nbindings].mod =
+				    CLEANMASK(sets[s].keys[i].mod);
+				bindings[nbindings++].key = &sets[s].keys[i];
+			}
+		}
+		keymap[s][k] = nbindings;
+	}
+}
+
+Bool
+updatelayout(void)
+{
+	int c, cc, fc, width, x;
+
+	if (!lay.stale && lay.n == nclients && lay.w == ww && lay.sel == sel)
+		return False;
+
+	cc = ww / tabwidth;
+	if (nclients > cc)
+		cc = (ww - lay.bw - lay.aw) / tabwidth;
+
+	/* keep the selected tab centered */
+	fc = sel - cc / 2 + (cc + 1) % 2;
+	fc = sel < 0 || fc < 0 ? 0 :
+	     fc + cc > nclients ? MAX(0, nclients - cc) :
+	     fc;
+
+	x = fc > 0 ? lay.bw : 0;
+	width = ww - x - (fc + cc < nclients ? lay.aw : 0);
+
+	/*
+	 * The selected tab carries the width remainder, a selection moving
+	 * within the visible tabs only recolors them if there is none.
+	 */
+	if (!lay.stale && lay.n == nclients && lay.w == ww && lay.fc == fc &&
+	    lay.cc > 0 && width % lay.cc == 0) {
+		if (lay.sel > -1 && lay.sel < nclients)
+			clients[lay.sel]->dirty = True;
+		if (sel > -1)
+			clients[sel]->dirty = True;
+		lay.sel = sel;
+		return False;
+	}
+
+	lay.after = fc + cc < nclients;
+	cc = MIN(cc, nclients);
+	for (c = fc; c < fc + cc; c++) {
+		x += width / cc + (c == sel ? width % cc : 0);
+		tab.x[c] = x;
+	}
+
+	lay.fc = fc;
+	lay.cc = cc;
+	lay.x = fc > 0 ? lay.bw : 0;
+	lay.sel = sel;
+	lay.n = nclients;
+	lay.w = ww;
+	lay.stale = False;
+
+	return True;
 }
 
 void
@@ -1268,6 +3599,7 @@ updatenumlockmask(void)
 
 	numlockmask = 0;
 	modmap = XGetModifierMapping(dpy);
+	stats.roundtrips[curevent]++;
 	for (i = 0; i < 8; i++) {
 		for (j = 0; j < modmap->max_keypermod; j++) {
 			if (modmap->modifiermap[i * modmap->max_keypermod + j]
@@ -1278,24 +3610,132 @@ updatenumlockmask(void)
 	XFreeModifiermap(modmap);
 }
 
+/* Finishes what showtab() left for after the batch. */
+void
+updatestates(void)
+{
+	int c;
+
+	if (!statesasked)
+		return;
+	statesasked = False;
+	stats.roundtrips[curevent]++;
+	for (c = 0; c < nclients; c++)
+		unsethidden(c);
+}
+
 void
 updatetitle(int c)
 {
-	if (!gettextprop(clients[c]->win, wmatom[WMName], clients[c]->name,
-	    sizeof(clients[c]->name)))
-		gettextprop(clients[c]->win, XA_WM_NAME, clients[c]->name,
-		            sizeof(clients[c]->name));
+	xcb_get_property_cookie_t ck[2];
+
+	ck[0] = getprop(tab.win[c], wmatom[WMName], XCB_ATOM_ANY, NAMELEN);
+	ck[1] = getprop(tab.win[c], XA_WM_NAME, XCB_ATOM_ANY, NAMELEN);
+	stats.roundtrips[curevent]++;
+	updatetitlefrom(c, ck);
+}
+
+/* Takes the title from _NET_WM_NAME and WM_NAME, requested as ck. */
+void
+updatetitlefrom(int c, xcb_get_property_cookie_t ck[2])
+{
+	char name[NAMELEN];
+
+	if (!textprop(propreply(ck[0]), name, sizeof(name)))
+		textprop(propreply(ck[1]), name, sizeof(name));
+	else
+		xcb_discard_reply(xc, ck[1].sequence);
+	if (!strcmp(name, clients[c]->name))
+		return;
+
+	indextitle(clients[c], False);
+	memcpy(clients[c]->name, name, sizeof(name));
+	indextitle(clients[c], True);
+	sessionchanged();
+	ctlevent("title 0x%lx %s\n", tab.win[c], ctlescape(name));
+	clients[c]->fit.len = -1;
+	clients[c]->dirty = True;
 	if (sel == c)
 		xsettitle(win, clients[c]->name);
 	drawbar();
 }
 
+unsigned int
+winhash(Window w)
+{
+	/* Fibonacci hashing, window ids mostly differ in their low bits */
+	return (unsigned int)(((unsigned long long)w *
+	       0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+/* WM_HINTS as XGetWMHints() would return them, frees the reply. */
+XWMHints *
+wmhints(xcb_get_property_reply_t *r)
+{
+	XWMHints *wmh = NULL;
+	uint32_t *v;
+
+	if (r && r->type == XA_WM_HINTS && r->format == 32 &&
+	    r->value_len >= 8 && (wmh = XAllocWMHints())) {
+		v = xcb_get_property_value(r);
+		wmh->flags = v[0];
+		wmh->input = v[1];
+		wmh->initial_state = v[2];
+		wmh->icon_pixmap = v[3];
+		wmh->icon_window = v[4];
+		wmh->icon_x = v[5];
+		wmh->icon_y = v[6];
+		wmh->icon_mask = v[7];
+		wmh->window_group = r->value_len > 8 ? v[8] : None;
+	}
+	free(r);
+
+	return wmh;
+}
+
+/*
+ * _NET_WM_PID is only meaningful if the client runs on our host, as told by
+ * WM_CLIENT_MACHINE. Frees both replies.
+ */
+pid_t
+wmpid(xcb_get_property_reply_t *p, xcb_get_property_reply_t *host)
+{
+	char name[256];
+	pid_t pid = 0;
+	int n;
+
+	if (p && p->type == XA_CARDINAL && p->format == 32 &&
+	    p->value_len == 1)
+		pid = *(uint32_t *)xcb_get_property_value(p);
+	if (pid && (!host || host->format != 8 ||
+	    gethostname(name, sizeof(name)) == -1 ||
+	    (n = xcb_get_property_value_length(host)) != strlen(name) ||
+	    memcmp(name, xcb_get_property_value(host), n)))
+		pid = 0;
+	free(p);
+	free(host);
+
+	return pid;
+}
+
 /* There's no way to check accesses to destroyed windows, thus those cases are
- * ignored (especially on UnmapNotify's).  Other types of errors call Xlibs
- * default error handler, which may call exit.  */
+ * ignored (especially on UnmapNotify's).  Requests are not synced, so errors
+ * for clients which are already unmanaged are told apart by their serial.
+ * Other types of errors call Xlibs default error handler, which may call
+ * exit.  */
 int
 xerror(Display *dpy, XErrorEvent *ee)
 {
+	unsigned int i;
+
+	for (i = 0; i < LENGTH(dead); i++) {
+		if (dead[i].win == ee->resourceid &&
+		    ee->serial < dead[i].serial) {
+			stats.deaderrors++;
+			return 0;
+		}
+	}
+
 	if (ee->error_code == BadWindow
 	    || (ee->request_code == X_SetInputFocus &&
 	        ee->error_code == BadMatch)
@@ -1336,41 +3776,53 @@ xsettitle(Window w, const char *str)
 void
 xseticon(void)
 {
-	Atom ret_type;
-	XWMHints *wmh, *cwmh;
-	int ret_format;
-	unsigned long ret_nitems, ret_nleft;
-	long offset = 0L;
-	unsigned char *data;
+	Client *c = clients[sel];
+	xcb_get_property_cookie_t ck[2], winck;
+	XWMHints *wmh;
+	Bool fetch = !c->iconvalid;
+
+	/* ours are needed unless the icon is unchanged, ask for all at once */
+	if (fetch) {
+		ck[0] = getprop(tab.win[sel], wmatom[WMIcon], XA_CARDINAL,
+		                UINT32_MAX);
+		ck[1] = getprop(tab.win[sel], XA_WM_HINTS, XA_WM_HINTS, 9);
+	}
+	winck = getprop(win, XA_WM_HINTS, XA_WM_HINTS, 9);
+	if (fetch) {
+		stats.roundtrips[curevent]++;
+		updateicon(sel, ck);
+	}
+	if (c->iconhash == winiconhash) {
+		xcb_discard_reply(xc, winck.sequence);
+		return;
+	}
 
-	wmh = XGetWMHints(dpy, win);
+	if (!fetch)
+		stats.roundtrips[curevent]++;
+	if (!(wmh = wmhints(propreply(winck))))
+		return;
+	winiconhash = c->iconhash;
 	wmh->flags &= ~(IconPixmapHint | IconMaskHint);
 	wmh->icon_pixmap = wmh->icon_mask = None;
 
-
-	if (XGetWindowProperty(dpy, clients[sel]->win, wmatom[WMIcon], offset, LONG_MAX, False,
-	                       XA_CARDINAL, &ret_type, &ret_format, &ret_nitems,
-	                       &ret_nleft, &data) == Success &&
-	    ret_type == XA_CARDINAL && ret_format == 32)
-	{
+	if (c->icon) {
 		XChangeProperty(dpy, win, wmatom[WMIcon], XA_CARDINAL, 32,
-		                PropModeReplace, data, ret_nitems);
-	} else if ((cwmh = XGetWMHints(dpy, clients[sel]->win)) && cwmh->flags & IconPixmapHint) {
+		                PropModeReplace, (unsigned char *)c->icon,
+		                c->nicon);
+	} else if (c->iconpixmap) {
 		XDeleteProperty(dpy, win, wmatom[WMIcon]);
 		wmh->flags |= IconPixmapHint;
-		wmh->icon_pixmap = cwmh->icon_pixmap;
-		if (cwmh->flags & IconMaskHint) {
+		wmh->icon_pixmap = c->iconpixmap;
+		if (c->iconmask) {
 			wmh->flags |= IconMaskHint;
-			wmh->icon_mask = cwmh->icon_mask;
+			wmh->icon_mask = c->iconmask;
 		}
-		XFree(cwmh);
 	} else {
 		XChangeProperty(dpy, win, wmatom[WMIcon], XA_CARDINAL, 32,
 		                PropModeReplace, (unsigned char *) icon, ICON_WIDTH * ICON_HEIGHT + 2);
 	}
 	XSetWMHints(dpy, win, wmh);
 	XFree(wmh);
-	XFree(data);
 }
 
 void
@@ -1378,7 +3830,7 @@ usage(void)
 {
 	die("usage: %s [-dfksv] [-g geometry] [-n name] [-p [s+/-]pos]\n"
 	    "       [-r narg] [-o color] [-O color] [-t color] [-T color]\n"
-	    "       [-u color] [-U color] command...\n", argv0);
+	    "       [-u color] [-U color] [-S session] command...\n", argv0);
 }
 
 int
@@ -1426,6 +3878,9 @@ main(int argc, char *argv[])
 	case 'r':
 		replace = atoi(EARGF(usage()));
 		break;
+	case 'S':
+		sessionfile = EARGF(usage());
+		break;
 	case 's':
 		doinitspawn = False;
 		break;
@@ -1476,6 +3931,8 @@ main(int argc, char *argv[])
 		}
 	}
 
+	if (sessionfile)
+		loadsession();
 	run();
 	cleanup();
 	XCloseDisplay(dpy);